@@ -27,17 +27,20 @@
 #include <avr/pgmspace.h>
 
 #include "print.h"
+#include "profile.h"
 
 void print_P(const char *s)
 {
 	char c;
 
+	PROF_ENTER(PROF_PRINT);
 	while (1) {
 		c = pgm_read_byte(s++);
 		if (!c) break;
 		if (c == '\n') usb_debug_putchar('\r');
 		usb_debug_putchar(c);
 	}
+	PROF_EXIT(PROF_PRINT);
 }
 
 void phex1(unsigned char c)
@@ -47,8 +50,10 @@ void phex1(unsigned char c)
 
 void phex(unsigned char c)
 {
+	PROF_ENTER(PROF_PRINT);
 	phex1(c >> 4);
 	phex1(c & 15);
+	PROF_EXIT(PROF_PRINT);
 }
 
 void phex16(unsigned int i)
@@ -57,6 +62,19 @@ void phex16(unsigned int i)
 	phex(i);
 }
 
-
-
-
+void pdecimal(unsigned long i)
+{
+	char str[10];
+	if (i == 0) {
+		usb_debug_putchar('0');
+		return;
+	}
+	int idx = 0;
+	while (i > 0) {
+		str[idx++] = i % 10;
+		i /= 10;
+	}
+	while (idx > 0) {
+		usb_debug_putchar('0' + str[--idx]);
+	}
+}
@@ -13,5 +13,6 @@ void print_P(const char *s);
 void phex1(unsigned char c);
 void phex(unsigned char c);
 void phex16(unsigned int i);
+void pdecimal(unsigned long i);
 
 #endif
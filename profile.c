@@ -0,0 +1,87 @@
+/*
+ * Cycle-counting profiler for the Teensy SIMM tester. See profile.h.
+ *
+ * (C) 2021 Simon Frankau
+ */
+
+#ifdef PROFILE
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "print.h"
+#include "profile.h"
+
+uint32_t prof_cycles[PROF_COUNT];
+uint32_t prof_calls[PROF_COUNT];
+volatile uint16_t prof_overflows;
+
+// Cycles taken by an empty ENTER/EXIT pair, taken off each call when
+// reporting, as it's a big part of something as small as simm_write.
+static uint16_t prof_overhead;
+
+ISR(TIMER3_OVF_vect)
+{
+	prof_overflows++;
+}
+
+static const char prof_names[PROF_COUNT][12] PROGMEM = {
+	"simm_write",
+	"simm_read",
+	"popcount",
+	"print",
+	"putchar",
+};
+
+static void prof_reset(void)
+{
+	for (int i = 0; i < PROF_COUNT; i++) {
+		prof_cycles[i] = 0;
+		prof_calls[i] = 0;
+	}
+}
+
+void prof_init(void)
+{
+	// Normal mode, no prescaling: one tick per CPU cycle, with an
+	// interrupt on each overflow.
+	TCCR3A = 0;
+	TCCR3B = 1 << CS30;
+	TIFR3 = 1 << TOV3;
+	TIMSK3 = 1 << TOI3;
+
+	PROF_ENTER(PROF_SIMM_WRITE);
+	PROF_EXIT(PROF_SIMM_WRITE);
+	prof_overhead = prof_cycles[PROF_SIMM_WRITE];
+	prof_reset();
+}
+
+// One line per report, e.g.
+// "Profile: simm_write 98304 calls 2949120 cycles, simm_read ...".
+// It's printed between entries, which the analyser skips.
+void prof_report(void)
+{
+	// Snapshot first, as printing the report is itself profiled.
+	uint32_t cycles[PROF_COUNT], calls[PROF_COUNT];
+	for (int i = 0; i < PROF_COUNT; i++) {
+		cycles[i] = prof_cycles[i];
+		calls[i] = prof_calls[i];
+	}
+
+	print("Profile: ");
+	for (int i = 0; i < PROF_COUNT; i++) {
+		uint32_t overhead = calls[i] * prof_overhead;
+		if (i != 0) print(", ");
+		print_P(prof_names[i]);
+		print(" ");
+		pdecimal(calls[i]);
+		print(" calls ");
+		pdecimal(cycles[i] > overhead ? cycles[i] - overhead : 0);
+		print(" cycles");
+	}
+	print("\n");
+	prof_reset();
+}
+
+#endif
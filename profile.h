@@ -0,0 +1,71 @@
+#ifndef profile_h__
+#define profile_h__
+
+// Lightweight cycle-counting profiler for the hot paths.
+//
+// Build with -DPROFILE (see the Makefile) to enable. Timer 3 then runs
+// free at the CPU clock, and each PROF_ENTER/PROF_EXIT pair adds the
+// cycles in between, and a call, to that region's counters. Regions
+// are inclusive, so e.g. PROF_PRINT includes PROF_PUTCHAR.
+//
+// The timer's overflows are counted by interrupt, extending it to 32
+// bits, so that regions that wait for USB, which can take several
+// overflows' worth of cycles, are counted in full. The interrupt
+// itself takes a few dozen cycles every 65536, which is lost in the
+// noise.
+//
+// Without PROFILE, everything here compiles to nothing.
+
+#include <stdint.h>
+
+enum {
+	PROF_SIMM_WRITE,
+	PROF_SIMM_READ,
+	PROF_POPCOUNT,	// Counting flipped bits in read_mem.
+	PROF_PRINT,	// print and phex.
+	PROF_PUTCHAR,	// usb_debug_putchar, including USB waits.
+	PROF_COUNT
+};
+
+#ifdef PROFILE
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+extern uint32_t prof_cycles[PROF_COUNT];
+extern uint32_t prof_calls[PROF_COUNT];
+extern volatile uint16_t prof_overflows;
+
+// Cycles since prof_init, mod 2^32.
+static inline uint32_t prof_now(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t lo = TCNT3;
+	uint16_t hi = prof_overflows;
+	// An overflow that's happened, but not been serviced yet.
+	if ((TIFR3 & (1 << TOV3)) && lo < 0x8000)
+		hi++;
+	SREG = sreg;
+	return ((uint32_t)hi << 16) | lo;
+}
+
+#define PROF_ENTER(id) uint32_t prof_start_##id = prof_now()
+#define PROF_EXIT(id) do { \
+	prof_cycles[id] += prof_now() - prof_start_##id; \
+	prof_calls[id]++; \
+} while (0)
+
+void prof_init(void);		// start the timer
+void prof_report(void);		// print the counters, and reset them
+
+#else
+
+#define PROF_ENTER(id)
+#define PROF_EXIT(id)
+#define prof_init()
+#define prof_report()
+
+#endif
+
+#endif
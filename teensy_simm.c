@@ -6,14 +6,34 @@
 
 #include <stdlib.h>
 
+#include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 
 #include "usb_debug_only.h"
 #include "print.h"
+#include "profile.h"
 
 #define TEST_DECAYS 1
+// Find the fastest working clock and read delay at startup.
+#define CALIBRATE 1
+// Sleep at a low clock during decay waits, rather than spinning at
+// full speed and warming up the SIMM.
+#define IDLE_WAITS 1
+// Instead of decay tests, repeatedly run march tests to screen SIMMs.
+#define SCREEN 0
+// Skip saturated delays in the decay tests, and focus on the median.
+#define ADAPTIVE_SWEEP 1
+// Store the decay test data with a SECDED code, and count the errors
+// it could and couldn't correct.
+#define ECC 0
+// Test this many SIMMs at once. They share the address, data and WE
+// lines, and each has its own RAS line (see "SIMM control").
+#define N_MODULES 1
+// Also give each module its own CAS line.
+#define SEPARATE_CAS 0
 
 ////////////////////////////////////////////////////////////////////////
 // CPU prescaler
@@ -40,15 +60,73 @@ static inline void cpu_prescale(char i)
     CLKPR = i;
 }
 
+// The current prescaler setting, which may be changed from
+// CLOCK_SPEED by calibration.
+static char clock_speed;
+
+// cpu_prescale, safe to call once interrupts are on (e.g. after
+// usb_init).
+static void set_clock(char i)
+{
+    char sreg = SREG;
+    cli();
+    cpu_prescale(i);
+    SREG = sreg;
+    clock_speed = i;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // SIMM control.
 
 // Control lines all on Port D.
 #define CONTROL    PORTD
 #define CONTROL_EN DDRD
+static const char WE  = 4;
+
+// With several modules, only the selected module's RAS line is ever
+// asserted, so the others ignore the shared lines. RAS lines are D0,
+// D3, D4 and D5 (D6 is the LED). CAS alone does nothing, so modules
+// can share D1 for CAS, or have their own, on D1 and D7.
+static const char module_ras[] = { 1, 8, 16, 32 };
+#if SEPARATE_CAS
+static const char module_cas[] = { 2, 128 };
+#define MAX_MODULES 2
+#else
+static const char module_cas[] = { 2, 2, 2, 2 };
+#define MAX_MODULES 4
+#endif
+
+#if N_MODULES > MAX_MODULES
+#error "Not enough RAS/CAS lines for N_MODULES"
+#endif
+
+// The selected module's RAS and CAS lines. As constants, asserting
+// and releasing them are single cbi/sbi instructions. With several
+// modules, the lines that vary are variables, so each becomes a
+// load, in, and, out sequence instead. That adds a few cycles to each
+// access, and between RAS and CAS, but the time from CAS to sampling
+// the data is the same, as the strobe is the last instruction of the
+// sequence.
+#if N_MODULES > 1
+static char RAS = 1;
+#else
 static const char RAS = 1;
+#endif
+#if N_MODULES > 1 && SEPARATE_CAS
+static char CAS = 2;
+#else
 static const char CAS = 2;
-static const char WE  = 4;
+#endif
+
+void simm_select(unsigned char module)
+{
+#if N_MODULES > 1
+    RAS = module_ras[module];
+#if SEPARATE_CAS
+    CAS = module_cas[module];
+#endif
+#endif
+}
 
 // Data lines are B0-7.
 #define DATA_OUT PORTB
@@ -58,12 +136,28 @@ static const char WE  = 4;
 #define ADDR    PORTF
 #define ADDR_EN DDRF
 
+// Cycles between asserting CAS and sampling the data lines. The
+// default is what works with my wiring, calibrate() may change it.
+#define MAX_READ_DELAY 4
+static char read_delay;
+
+static char default_read_delay(void)
+{
+    return clock_speed == CPU_16MHz ? 2 : 1;
+}
+
 void simm_init(void)
 {
+    char lines = WE;
+    for (int m = 0; m < N_MODULES; m++) {
+        lines |= module_ras[m] | module_cas[m];
+    }
+    simm_select(0);
+
     // RAS, CAS and WE are all active low, so set them high...
-    CONTROL |= RAS | CAS | WE;
+    CONTROL |= lines;
     // And drive them.
-    CONTROL_EN |= RAS | CAS | WE;
+    CONTROL_EN |= lines;
 
     // Drive address lines.
     ADDR_EN |= 0xf3; // Bits 0-1, 4-7.
@@ -73,6 +167,8 @@ void simm_init(void)
     // TODO: F0-F1 are address lines we're not using yet.
     DDRF |= 3;
     PORTF |= 3;
+
+    read_delay = default_read_delay();
 }
 
 inline char addr_to_f(char c) {
@@ -82,6 +178,8 @@ inline char addr_to_f(char c) {
 
 void simm_write(char row, char col, char val)
 {
+    PROF_ENTER(PROF_SIMM_WRITE);
+
     // Write row.
     ADDR = addr_to_f(row);
     CONTROL &= ~RAS;
@@ -101,38 +199,107 @@ void simm_write(char row, char col, char val)
     DATA_EN &= 0x00;
     DATA_OUT = 0;
     CONTROL |= WE;
+
+    PROF_EXIT(PROF_SIMM_WRITE);
+}
+
+// Assert CAS and sample the data lines, with the calibrated delay.
+//
+// The input synchroniser has two flip-flops in series, delaying
+// the value being read, so we need to insert a NOP before the result of
+// the DRAM read will be available to an IN operation. One cycle seems
+// to be insufficient at 16MHz, perhaps due to the time it takes to
+// perform the read.
+//
+// The delay must be a compile-time constant, so pick a whole
+// CAS-delay-read sequence, and don't let the choice itself add to
+// the delay.
+static inline char cas_and_sample(void)
+{
+    char val;
+    switch (read_delay) {
+#define READ_AFTER(n) \
+    case n: \
+        CONTROL &= ~CAS; \
+        __builtin_avr_delay_cycles(n); \
+        val = DATA_IN; \
+        break
+    case 0:
+        CONTROL &= ~CAS;
+        val = DATA_IN;
+        break;
+    READ_AFTER(1);
+    READ_AFTER(2);
+    READ_AFTER(3);
+    default:
+        CONTROL &= ~CAS;
+        __builtin_avr_delay_cycles(MAX_READ_DELAY);
+        val = DATA_IN;
+        break;
+#undef READ_AFTER
+    }
+    return val;
 }
 
 char simm_read(char row, char col)
 {
+    PROF_ENTER(PROF_SIMM_READ);
+
     // Write row.
     ADDR = addr_to_f(row);
     CONTROL &= ~RAS;
 
-    // Write col.
+    // Write col, and read the data.
     ADDR = addr_to_f(col);
-    CONTROL &= ~CAS;
+    char val = cas_and_sample();
 
-    // The input synchroniser has two flip-flops in series, delaying
-    // the value being read, so we need to insert a NOP before the result of
-    // the DRAM read will be available to an IN operation.
-    if (CLOCK_SPEED == CPU_16MHz) {
-        // One cycle seems to be insufficient at 16MHz, perhaps due to the
-        // time it takes to perform the read.
-        __builtin_avr_delay_cycles(2);
-    } else {
-        __builtin_avr_delay_cycles(1);
-    }
+    // Release RAS and CAS.
+    CONTROL |= RAS | CAS;
+
+    PROF_EXIT(PROF_SIMM_READ);
+    return val;
+}
 
-    // Read the data.
-    char val = DATA_IN;
+// Page mode: open a row with RAS, then access a few columns in it
+// with just CAS, saving the row address setup on each access.
+//
+// RAS mustn't be held low for more than tRAS(max), which is 10us on
+// some parts, so bursts have to be sized to the clock speed.
+#define TRAS_MAX_US 10
 
-    // Release RAS and CAS.
+static inline void simm_page_open(char row)
+{
+    ADDR = addr_to_f(row);
+    CONTROL &= ~RAS;
+}
+
+static inline void simm_page_close(void)
+{
     CONTROL |= RAS | CAS;
+}
 
+static inline char simm_page_read(char col)
+{
+    ADDR = addr_to_f(col);
+    char val = cas_and_sample();
+    CONTROL |= CAS;
     return val;
 }
 
+// An early write: WE goes low before CAS, so data is latched on CAS.
+static inline void simm_page_write(char col, char val)
+{
+    ADDR = addr_to_f(col);
+    DATA_OUT = val;
+    DATA_EN |= 0xff;
+    CONTROL &= ~WE;
+    CONTROL &= ~CAS;
+    CONTROL |= CAS;
+    CONTROL |= WE;
+    DATA_EN &= 0x00;
+    DATA_OUT = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // LED
 //
@@ -152,73 +319,252 @@ static inline void led_off(void)
     PORTD &= ~(1 << 6);
 }
 
+////////////////////////////////////////////////////////////////////////
+// SECDED ECC
+//
+// To see how far ECC could stretch the refresh interval, ECC mode
+// stores each row as 7 words of a Hamming (72, 64) SECDED code, like
+// an ECC DIMM: 8 adjacent data bytes, spread over all 8 data lines,
+// followed by a check byte. The last column is left as plain data.
+//
+// Check bits 0-6 are the XOR of the Hamming positions (1-71, skipping
+// the powers of two, which belong to the check bits) of the set data
+// bits, and bit 7 makes the parity of the whole word even. On
+// read-back, a syndrome with odd parity is a single error, which we
+// correct, and a non-zero one with even parity is a double error,
+// which we can only detect.
+//
+
+#if ECC
+
+#define ECC_DATA_BYTES 8
+#define ECC_WORD_BYTES (ECC_DATA_BYTES + 1)
+#define ECC_WORDS_PER_ROW (0x40 / ECC_WORD_BYTES)
+#define ECC_WORDS (0x40 * ECC_WORDS_PER_ROW)
+
+// Hamming position of each data bit, byte by byte.
+static unsigned char ecc_positions[ECC_DATA_BYTES * 8];
+
+static void ecc_init(void)
+{
+    unsigned char pos = 1;
+    for (int i = 0; i < ECC_DATA_BYTES * 8; i++) {
+        // Skip the check bits' positions.
+        while ((pos & (pos - 1)) == 0) {
+            pos++;
+        }
+        ecc_positions[i] = pos++;
+    }
+}
+
+static unsigned char parity(unsigned char v)
+{
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+}
+
+// Check bits 0-6 for the given data bytes.
+static unsigned char ecc_hamming(const unsigned char *data)
+{
+    unsigned char h = 0;
+    for (int i = 0; i < ECC_DATA_BYTES; i++) {
+        const unsigned char *pos = &ecc_positions[i * 8];
+        for (unsigned char v = data[i]; v != 0; v >>= 1, pos++) {
+            if (v & 1) {
+                h ^= *pos;
+            }
+        }
+    }
+    return h;
+}
+
+// Parity of the data bytes and the given check byte.
+static unsigned char ecc_parity(const unsigned char *data, unsigned char check)
+{
+    unsigned char p = check;
+    for (int i = 0; i < ECC_DATA_BYTES; i++) {
+        p ^= data[i];
+    }
+    return parity(p);
+}
+
+static unsigned char ecc_check_byte(const unsigned char *data)
+{
+    unsigned char h = ecc_hamming(data);
+    return h | ecc_parity(data, h) << 7;
+}
+
+// Decode a word as read back, correcting a single error in place.
+// Returns 0 if it was clean, 1 if we corrected an error, or 2 if it
+// had errors we can't correct. Three or more errors may be
+// miscorrected, which only the caller can tell.
+static char ecc_decode(unsigned char *word)
+{
+    unsigned char check = word[ECC_DATA_BYTES];
+    unsigned char syndrome = (check & 0x7f) ^ ecc_hamming(word);
+    if (!ecc_parity(word, check)) {
+        return syndrome == 0 ? 0 : 2;
+    }
+    // A single error. In the check byte, the data is fine.
+    if ((syndrome & (syndrome - 1)) == 0) {
+        return 1;
+    }
+    for (int i = 0; i < ECC_DATA_BYTES * 8; i++) {
+        if (ecc_positions[i] == syndrome) {
+            word[i / 8] ^= 1 << (i % 8);
+            return 1;
+        }
+    }
+    // Off the end of the word, so there must be more errors.
+    return 2;
+}
+
+#endif
+
 ////////////////////////////////////////////////////////////////////////
 // And the main program itself...
 //
 
-static const int MAX_DIFFS = 32;
+#define MAX_DIFFS 32
+
+// An experiment's results, held in SRAM so that they can be printed
+// while the next experiment's cells decay, rather than delaying its
+// write.
+struct result {
+    char valid;
+    char module;
+    char pattern;
+    unsigned delay_seconds;
+    // Row, column and flipped bits of the first corrupt bytes.
+    unsigned char byte_count;
+    unsigned char diffs[MAX_DIFFS - 1][3];
+    unsigned bit_count;
+    // Words ECC corrected, and couldn't, in ECC mode.
+    unsigned ecc_corrected;
+    unsigned ecc_uncorrectable;
+    unsigned long active_ms;
+    unsigned long output_ms;
+    // The wait left after the writes of any later modules and the
+    // output, asleep with IDLE_WAITS.
+    unsigned long wait_ms;
+    unsigned long wakeups;
+};
+
+static struct result last_results[N_MODULES];
+
+// What we write to each column of every row: the pattern, or in ECC
+// mode, the pattern encoded into words.
+static char expected[0x40];
+
+static void fill_expected(char v)
+{
+    for (int c = 0; c < 0x40; c++) {
+        expected[c] = v;
+    }
+#if ECC
+    // The data is the same in every word, so they all have the same
+    // check byte.
+    unsigned char data[ECC_DATA_BYTES];
+    for (int i = 0; i < ECC_DATA_BYTES; i++) {
+        data[i] = v;
+    }
+    char check = ecc_check_byte(data);
+    for (int w = 0; w < ECC_WORDS_PER_ROW; w++) {
+        expected[w * ECC_WORD_BYTES + ECC_DATA_BYTES] = check;
+    }
+#endif
+}
 
 void write_mem(char v)
 {
+    fill_expected(v);
     // Write 4K bytes in different rows and columns...
     for (int r = 0; r < 0x40; r++) {
         for (int c = 0; c < 0x40; c++) {
-            simm_write(r, c, v);
+            simm_write(r, c, expected[c]);
         }
     }
 }
 
-// Read memory, print diffs, return total count different.
-unsigned read_mem(char v)
+#if ECC
+// Decode a word that came back with raw errors, and count whether
+// ECC would have saved us.
+static void ecc_verify(unsigned char *word, char v, struct result *res)
+{
+    char ok = ecc_decode(word) != 2;
+    for (int i = 0; i < ECC_DATA_BYTES; i++) {
+        ok &= word[i] == (unsigned char)v;
+    }
+    if (ok) {
+        res->ecc_corrected++;
+    } else {
+        res->ecc_uncorrectable++;
+    }
+}
+#endif
+
+// Read memory written by write_mem(v), record diffs and the total
+// count different.
+void read_mem(char v, struct result *res)
 {
     unsigned byte_count = 0;
     unsigned bit_count = 0;
+    res->ecc_corrected = 0;
+    res->ecc_uncorrectable = 0;
 
     // Read 4K bytes in different rows and columns...
     for (int r = 0; r < 0x40; r++) {
+#if ECC
+        unsigned char word[ECC_WORD_BYTES];
+        unsigned char w = 0;
+        char dirty = 0;
+#endif
         for (int c = 0; c < 0x40; c++) {
             char v2 = simm_read(r, c);
-            if (v2 != v) {
-                byte_count++;
-                if (byte_count < MAX_DIFFS) {
-                    phex(r);
-                    phex(c);
-                    phex(v2 ^ v);
-                    print(",");
+            char e = expected[c];
+#if ECC
+            // Only words with raw errors need decoding.
+            word[w++] = v2;
+            dirty |= v2 ^ e;
+            if (w == ECC_WORD_BYTES) {
+                if (dirty) {
+                    ecc_verify(word, v, res);
+                }
+                w = 0;
+                dirty = 0;
+            }
+#endif
+            if (v2 != e) {
+                if (byte_count < MAX_DIFFS - 1) {
+                    res->diffs[byte_count][0] = r;
+                    res->diffs[byte_count][1] = c;
+                    res->diffs[byte_count][2] = v2 ^ e;
                 }
-                char d = v2 ^ v;
+                byte_count++;
+                PROF_ENTER(PROF_POPCOUNT);
+                char d = v2 ^ e;
                 while (d != 0) {
                     d &= d - 1;
                     bit_count++;
                 }
+                PROF_EXIT(PROF_POPCOUNT);
             }
         }
     }
 
-    return bit_count;
+    res->byte_count = byte_count < MAX_DIFFS - 1 ? byte_count : MAX_DIFFS - 1;
+    res->bit_count = bit_count;
 }
 
-void delay(unsigned s)
+// _delay_ms assumes we're running at F_CPU, so scale for any slower
+// clock chosen by calibration.
+void delay_ms(unsigned long ms)
 {
-    for (int i = 0; i < s; ++i) {
-        _delay_ms(1000);
-    }
-}
-
-void pdecimal(unsigned i)
-{
-    char str[10];
-    if (i == 0) {
-        usb_debug_putchar('0');
-        return;
-    }
-    int idx = 0;
-    while (i > 0) {
-        str[idx++] = i % 10;
-        i /= 10;
-    }
-    while (idx > 0) {
-        usb_debug_putchar('0' + str[--idx]);
+    ms >>= clock_speed;
+    for (unsigned long i = 0; i < ms; ++i) {
+        _delay_ms(1);
     }
 }
 
@@ -244,22 +590,764 @@ void test_read_write(void)
     }
 }
 
-// Test bit flips from the given pattern and delay
-void test_decays(char pattern, unsigned delay_seconds)
+////////////////////////////////////////////////////////////////////////
+// Low-power waits
+//
+
+// Clock to drop to while waiting for the DRAM to decay. Must be
+// CPU_4MHz or slower, so that a second of timer ticks fits in 16
+// bits. USB still needs servicing, so don't go too slow.
+#define IDLE_CLOCK CPU_2MHz
+
+static volatile unsigned idle_seconds;
+
+ISR(TIMER1_COMPA_vect)
+{
+    idle_seconds++;
+}
+
+// Sleep for ms milliseconds at IDLE_CLOCK, timed by Timer 1, and
+// return to the previous clock for the read-back. Idle mode leaves
+// USB running, so the connection stays up, and its start-of-frame
+// interrupts wake us every millisecond or so.
+//
+// Returns the number of times we woke up.
+unsigned long idle_delay_ms(unsigned long ms)
+{
+    char active_clock = clock_speed;
+    unsigned long wakeups = 0;
+    unsigned ticks_per_s = (F_CPU / 64) >> IDLE_CLOCK;
+    unsigned s = ms / 1000;
+    unsigned rem = ms % 1000;
+
+    // Don't leave anything sitting in the buffer while we sleep.
+    usb_debug_flush_output();
+    set_clock(IDLE_CLOCK);
+
+    // CTC mode, clk/64, interrupting once a second. Any part second
+    // comes first, by starting the count part way through.
+    idle_seconds = 0;
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    if (rem != 0) {
+        TCNT1 = ticks_per_s - (unsigned long)rem * ticks_per_s / 1000;
+        s++;
+    }
+    OCR1A = ticks_per_s - 1;
+    TIFR1 = 1 << OCF1A;
+    TIMSK1 = 1 << OCIE1A;
+    TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10);
+
+    // Check and sleep with interrupts off, so that the wake-up can't
+    // slip in between. sei() takes effect after the next instruction,
+    // so the sleep always happens first.
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    while (idle_seconds < s) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+        wakeups++;
+    }
+    sei();
+
+    TIMSK1 = 0;
+    TCCR1B = 0;
+    set_clock(active_clock);
+    return wakeups;
+}
+
+// Time the active parts of an experiment with Timer 1, at clk/1024.
+// That overflows after about 4s at 16MHz, well over a write,
+// read-back or printing the results.
+static void active_timer_start(void)
+{
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    TCCR1B = (1 << CS12) | (1 << CS10);
+}
+
+// Milliseconds since active_timer_start.
+static unsigned long active_timer_stop(void)
+{
+    unsigned long ticks = TCNT1;
+    TCCR1B = 0;
+    // Each tick is 1024 cycles, or 64us at 16MHz.
+    return ticks * (64 << clock_speed) / 1000;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Calibration
+//
+
+// Extra cycles of read delay on top of the shortest that works.
+#define READ_DELAY_MARGIN 1
+
+// Write and verify the test_read_write pattern, or its complement,
+// over the whole wired array.
+static char verify_pattern(char invert)
+{
+    for (int r = 0; r < 0x40; r++) {
+        for (int c = 0; c < 0x40; c++) {
+            simm_write(r, c, (r + (c << 1)) ^ invert);
+        }
+    }
+    for (int r = 0; r < 0x40; r++) {
+        for (int c = 0; c < 0x40; c++) {
+            unsigned char v = simm_read(r, c);
+            if (v != (unsigned char)((r + (c << 1)) ^ invert)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Every bit of every location of every module is checked both ways.
+static char verify_patterns(void)
+{
+    char ok = 1;
+    for (int m = 0; m < N_MODULES && ok; m++) {
+        simm_select(m);
+        ok = verify_pattern(0x00) && verify_pattern(0xff);
+    }
+    simm_select(0);
+    return ok;
+}
+
+// Find the fastest clock (from CLOCK_SPEED down to 2MHz) and the
+// shortest read delay that reads back cleanly, with margin, and use
+// them from now on. Faster clocks always win, as a few extra cycles
+// of read delay are cheaper than halving the speed of everything.
+//
+// We don't go below 2MHz, so that delay_ms() can scale exactly.
+void calibrate(void)
 {
+    for (char clk = CLOCK_SPEED; clk <= CPU_2MHz; clk++) {
+        set_clock(clk);
+        for (char d = 0; d + READ_DELAY_MARGIN <= MAX_READ_DELAY; d++) {
+            read_delay = d;
+            char ok = verify_patterns();
+            if (ok) {
+                // And make sure we're clear of the edge.
+                read_delay = d + READ_DELAY_MARGIN;
+                ok = verify_patterns();
+            }
+            print("Calibrate: ");
+            pdecimal(16 >> clk);
+            print("MHz, delay ");
+            pdecimal(d);
+            if (!ok) {
+                print(": FAIL\n");
+            } else {
+                print(": OK\n");
+                print("Calibrated: ");
+                pdecimal(16 >> clk);
+                print("MHz, read delay ");
+                pdecimal(read_delay);
+                print("\n");
+                return;
+            }
+        }
+    }
+
+    // Nothing worked, so likely a wiring problem. Go back to the
+    // defaults, and let the tests show what's wrong.
+    set_clock(CLOCK_SPEED);
+    read_delay = default_read_delay();
+    print("Calibration FAILED, using defaults\n");
+}
+
+////////////////////////////////////////////////////////////////////////
+// March tests, for screening SIMMs before decay experiments.
+//
+// A march test is a list of elements, each of which runs a short
+// sequence of operations on every address, in ascending or
+// descending order, before moving to the next element. "0" and "1"
+// are the data background and its complement, and we repeat the
+// test over several backgrounds to catch coupling between the bits
+// of a byte.
+//
+
+// Operations: bit 1 is write, bit 0 the value.
+#define R0 0
+#define R1 1
+#define W0 2
+#define W1 3
+
+#define UP   0
+#define DOWN 1
+
+struct march_element {
+    char order;
+    char n_ops;
+    char ops[4];
+};
+
+struct march_test {
+    const char *name;  // In program memory.
+    char n_elements;
+    const struct march_element *elements;
+};
+
+// March C-: {any(w0); up(r0,w1); up(r1,w0); down(r0,w1); down(r1,w0);
+// any(r0)}. Stuck-at, transition, address decoder and unlinked
+// coupling faults.
+static const struct march_element march_c_minus_elements[] = {
+    { UP,   1, { W0 } },
+    { UP,   2, { R0, W1 } },
+    { UP,   2, { R1, W0 } },
+    { DOWN, 2, { R0, W1 } },
+    { DOWN, 2, { R1, W0 } },
+    { UP,   1, { R0 } },
+};
+
+// MATS+: {any(w0); up(r0,w1); down(r1,w0)}. Stuck-at and address
+// decoder faults, quickly.
+static const struct march_element mats_plus_elements[] = {
+    { UP,   1, { W0 } },
+    { UP,   2, { R0, W1 } },
+    { DOWN, 2, { R1, W0 } },
+};
+
+// Edit this to run your own element list. By default it's March X:
+// {any(w0); up(r0,w1); down(r1,w0); any(r0)}.
+static const struct march_element march_custom_elements[] = {
+    { UP,   1, { W0 } },
+    { UP,   2, { R0, W1 } },
+    { DOWN, 2, { R1, W0 } },
+    { UP,   1, { R0 } },
+};
+
+#define ELEMENTS(e) (sizeof(e) / sizeof(e[0])), e
+
+static const char march_c_minus_name[] PROGMEM = "March C-";
+static const char mats_plus_name[] PROGMEM = "MATS+";
+static const char march_custom_name[] PROGMEM = "Custom";
+
+static const struct march_test march_tests[] = {
+    { mats_plus_name, ELEMENTS(mats_plus_elements) },
+    { march_c_minus_name, ELEMENTS(march_c_minus_elements) },
+    { march_custom_name, ELEMENTS(march_custom_elements) },
+};
+
+// Solid, checkerboard, and pairs and nibbles of bits, so every pair
+// of bits in a byte is written both the same and different.
+static const unsigned char march_backgrounds[] = { 0x00, 0x55, 0x33, 0x0f };
+
+// Faults found, per bit and background, so that two faulty bits in a
+// byte are classified separately. SRAM is tight, so we keep the first
+// few, and after that just count the failing reads.
+#define MAX_FAULTS 16
+
+struct fault {
+    unsigned char row;
+    unsigned char col;
+    unsigned char background;
+    unsigned char bit;
+    // Which reads failed, as a bit per read op in test order.
+    unsigned long failed_reads;
+};
+
+static struct fault faults[MAX_FAULTS];
+static unsigned char n_faults;
+static unsigned long unrecorded_reads;
+
+static void record_fault_bit(char row, char col, unsigned char background,
+                             unsigned char bit, unsigned char read_idx)
+{
+    for (int i = 0; i < n_faults; i++) {
+        struct fault *f = &faults[i];
+        if (f->row == row && f->col == col && f->background == background &&
+            f->bit == bit) {
+            f->failed_reads |= 1UL << read_idx;
+            return;
+        }
+    }
+    if (n_faults == MAX_FAULTS) {
+        unrecorded_reads++;
+        return;
+    }
+    struct fault *f = &faults[n_faults++];
+    f->row = row;
+    f->col = col;
+    f->background = background;
+    f->bit = bit;
+    f->failed_reads = 1UL << read_idx;
+}
+
+static void record_fault(char row, char col, unsigned char background,
+                         unsigned char bits, unsigned char read_idx)
+{
+    for (unsigned char bit = 0; bit < 8; bit++) {
+        if (bits & (1 << bit)) {
+            record_fault_bit(row, col, background, bit, read_idx);
+        }
+    }
+}
+
+// A rough upper bound on the cycles an op takes in march_run(): the
+// page mode read or write, plus the loop around it. A burst of 4
+// columns of a read and a write each takes about 350 cycles.
+#define MARCH_OP_CYCLES 48
+
+// How many ops fit in one page mode burst at the current clock,
+// within tRAS(max): 3 at 16MHz, 1 at 8MHz and none below.
+static unsigned char march_burst_ops(void)
+{
+    return (TRAS_MAX_US * (F_CPU / 1000000UL) >> clock_speed) / MARCH_OP_CYCLES;
+}
+
+// Run every element of the test over the whole wired array with the
+// given background, using page mode bursts of as many columns as fit
+// within tRAS(max). When not even one column's ops fit, each op gets
+// a RAS cycle of its own, like simm_read().
+static void march_run(const struct march_test *test, unsigned char background)
+{
+    unsigned char read_idx = 0;
+    unsigned char burst_ops = march_burst_ops();
+    for (int e = 0; e < test->n_elements; e++) {
+        const struct march_element *el = &test->elements[e];
+        char burst = burst_ops / el->n_ops;
+        char reopen = burst == 0;
+        if (reopen) {
+            burst = 1;
+        }
+        for (int ri = 0; ri < 0x40; ri++) {
+            char r = el->order == DOWN ? 0x3f - ri : ri;
+            for (int cb = 0; cb < 0x40; cb += burst) {
+                int ce = cb + burst < 0x40 ? cb + burst : 0x40;
+                simm_page_open(r);
+                for (int ci = cb; ci < ce; ci++) {
+                    char c = el->order == DOWN ? 0x3f - ci : ci;
+                    unsigned char idx = read_idx;
+                    for (int o = 0; o < el->n_ops; o++) {
+                        char op = el->ops[o];
+                        unsigned char v = (op & 1) ? ~background : background;
+                        if (reopen && o != 0) {
+                            simm_page_close();
+                            simm_page_open(r);
+                        }
+                        if (op & 2) {
+                            simm_page_write(c, v);
+                            continue;
+                        }
+                        unsigned char got = simm_page_read(c);
+                        if (got != v) {
+                            // Bookkeeping takes a while, so let go of
+                            // the row.
+                            simm_page_close();
+                            record_fault(r, c, background, got ^ v, idx);
+                            simm_page_open(r);
+                        }
+                        idx++;
+                    }
+                }
+                simm_page_close();
+            }
+        }
+        for (int o = 0; o < el->n_ops; o++) {
+            if (!(el->ops[o] & 2)) {
+                read_idx++;
+            }
+        }
+    }
+}
+
+// Which reads of the test are of the complement of the background
+// (otherwise the background)?
+static unsigned long march_reads_of_ones(const struct march_test *test,
+                                         unsigned long *all_reads)
+{
+    unsigned long ones = 0;
+    unsigned char read_idx = 0;
+    for (int e = 0; e < test->n_elements; e++) {
+        const struct march_element *el = &test->elements[e];
+        for (int o = 0; o < el->n_ops; o++) {
+            if (!(el->ops[o] & 2)) {
+                if (el->ops[o] & 1) {
+                    ones |= 1UL << read_idx;
+                }
+                read_idx++;
+            }
+        }
+    }
+    *all_reads = read_idx >= 32 ? ~0UL : (1UL << read_idx) - 1;
+    return ones;
+}
+
+// Classify a faulty bit from which reads detected it. A stuck-at or
+// transition fault fails every read of one physical value, whereas
+// coupling and address decoder faults only show up after particular
+// writes elsewhere, so fail some reads and not others. "0" and "1"
+// are the background and its complement, so which of them is a
+// physical 1 depends on the background's bit.
+//
+// The first read of "0" may pass for a cell that can't change, as it
+// only had to hold whatever it powered up with.
+static void print_fault_class(const struct march_test *test,
+                              const struct fault *f)
+{
+    unsigned long all;
+    unsigned long ones = march_reads_of_ones(test, &all);
+    unsigned long zeros = all & ~ones;
+    unsigned long first_zero = zeros & -zeros;
+    unsigned long highs = (f->background >> f->bit) & 1 ? zeros : ones;
+    unsigned long lows = all & ~highs;
+    unsigned long failed = f->failed_reads;
+
+    if ((failed & lows) == 0 && (failed | (first_zero & highs)) == highs) {
+        print("stuck-at-0/transition up");
+    } else if ((failed & highs) == 0 && (failed | (first_zero & lows)) == lows) {
+        print("stuck-at-1/transition down");
+    } else {
+        print("coupling/address decoder");
+    }
+}
+
+// Run a march test over all backgrounds, and report throughput and
+// any faults. Returns whether any read failed.
+char march_test(const struct march_test *test)
+{
+    unsigned ops_per_addr = 0;
+    for (int e = 0; e < test->n_elements; e++) {
+        ops_per_addr += test->elements[e].n_ops;
+    }
+
+    n_faults = 0;
+    unrecorded_reads = 0;
+    unsigned long total_ms = 0;
+    for (int b = 0; b < sizeof(march_backgrounds); b++) {
+        active_timer_start();
+        march_run(test, march_backgrounds[b]);
+        total_ms += active_timer_stop();
+    }
+
+    // And report.
+    unsigned long ops = (unsigned long)ops_per_addr * 0x40 * 0x40 * sizeof(march_backgrounds);
+    print_P(test->name);
+    print(": ");
+    pdecimal(ops);
+    print(" ops in ");
+    pdecimal(total_ms);
+    print("ms, ");
+    pdecimal(total_ms ? ops / total_ms : 0);
+    print(" kops/s\n");
+
+    for (int i = 0; i < n_faults; i++) {
+        const struct fault *f = &faults[i];
+        print("Fault: ");
+        phex(f->row);
+        phex(f->col);
+        phex(1 << f->bit);
+        print(", background ");
+        phex(f->background);
+        print(", reads ");
+        phex16(f->failed_reads >> 16);
+        phex16(f->failed_reads);
+        print(", ");
+        print_fault_class(test, f);
+        print("\n");
+    }
+    if (unrecorded_reads) {
+        print("Failing reads not recorded: ");
+        pdecimal(unrecorded_reads);
+        print("\n");
+    }
+
+    print_P(test->name);
+    if (n_faults == 0) {
+        print(": PASS\n");
+        return 0;
+    }
+    print(": FAIL\n");
+    return 1;
+}
+
+// Screen a SIMM with all the march tests.
+void screen(void)
+{
+    for (int m = 0; m < N_MODULES; m++) {
+        simm_select(m);
+#if N_MODULES > 1
+        print("Module: ");
+        pdecimal(m);
+        print("\n");
+#endif
+        char failed = 0;
+        for (int i = 0; i < sizeof(march_tests) / sizeof(march_tests[0]); i++) {
+            failed |= march_test(&march_tests[i]);
+        }
+        if (!failed) {
+            print("Screen: PASS\n");
+        } else {
+            print("Screen: FAIL\n");
+        }
+        print("--------------------------------\n");
+    }
+    simm_select(0);
+}
+
+// Print the results of an experiment, in the same format as ever.
+void print_result(const struct result *res)
+{
+    if (!res->valid) {
+        return;
+    }
     print("Delay: ");
-    pdecimal(delay_seconds);
+    pdecimal(res->delay_seconds);
     print("000, Pattern: ");
-    phex(pattern);
+    phex(res->pattern);
     print("\n");
-    write_mem(pattern);
-    delay(delay_seconds);
-    unsigned diffs = read_mem(pattern);
+    for (int i = 0; i < res->byte_count; i++) {
+        phex(res->diffs[i][0]);
+        phex(res->diffs[i][1]);
+        phex(res->diffs[i][2]);
+        print(",");
+    }
     print("\nDiffs: ");
-    pdecimal(diffs);
+    pdecimal(res->bit_count);
+#if N_MODULES > 1
+    print("\nModule: ");
+    pdecimal(res->module);
+#endif
+#if ECC
+    print("\nECC: words ");
+    pdecimal(ECC_WORDS);
+    print(", corrected ");
+    pdecimal(res->ecc_corrected);
+    print(", uncorrectable ");
+    pdecimal(res->ecc_uncorrectable);
+#endif
+    // Estimated time spent at full speed versus asleep. Each wake-up
+    // is just an interrupt, so the idle time is almost all sleep.
+    // Without IDLE_WAITS, the wait spins at full speed instead.
+    print("\nPower: active ");
+    pdecimal(res->active_ms);
+    print("ms, output ");
+    pdecimal(res->output_ms);
+#if IDLE_WAITS
+    print("ms, idle ");
+    pdecimal(res->wait_ms);
+    print("ms, wakeups ");
+    pdecimal(res->wakeups);
+#else
+    print("ms, busy wait ");
+    pdecimal(res->wait_ms);
+    print("ms");
+#endif
     print("\n--------------------------------\n");
 }
 
+// Test bit flips from the given pattern and delay, on every module.
+//
+// The output is pipelined: the previous experiment's results are
+// printed while this one's cells decay, and this one's are held
+// until the next. A cycle then takes the write, wait and read-back,
+// rather than also waiting for USB.
+//
+// With several modules, they're written one after another, and read
+// back in the same order once the first has waited the delay. Their
+// waits overlap, so a cycle takes the delay plus a write and read
+// of each module, rather than the delay once per module. Writes and
+// reads take about as long as each other, so each module waits about
+// the delay.
+void test_decays(char pattern, unsigned delay_seconds)
+{
+    unsigned long active_ms[N_MODULES];
+    // Time since the first module was written.
+    unsigned long elapsed_ms = 0;
+
+    for (int m = 0; m < N_MODULES; m++) {
+        simm_select(m);
+        active_timer_start();
+        write_mem(pattern);
+        active_ms[m] = active_timer_stop();
+        if (m != 0) {
+            elapsed_ms += active_ms[m];
+        }
+    }
+
+    // Printing eats into the wait. It's a few hundred bytes at most
+    // per module, so takes a few milliseconds unless the host stalls.
+    active_timer_start();
+    for (int m = 0; m < N_MODULES; m++) {
+        print_result(&last_results[m]);
+    }
+    unsigned long output_ms = active_timer_stop();
+    elapsed_ms += output_ms;
+    unsigned long wait_ms = delay_seconds * 1000UL;
+    wait_ms = elapsed_ms < wait_ms ? wait_ms - elapsed_ms : 0;
+
+    unsigned long wakeups = 0;
+#if IDLE_WAITS
+    wakeups = idle_delay_ms(wait_ms);
+#else
+    delay_ms(wait_ms);
+#endif
+
+    for (int m = 0; m < N_MODULES; m++) {
+        struct result *res = &last_results[m];
+        simm_select(m);
+        active_timer_start();
+        read_mem(pattern, res);
+        active_ms[m] += active_timer_stop();
+
+        res->valid = 1;
+        res->module = m;
+        res->pattern = pattern;
+        res->delay_seconds = delay_seconds;
+        res->active_ms = active_ms[m];
+        res->output_ms = output_ms;
+        res->wait_ms = wait_ms;
+        res->wakeups = wakeups;
+    }
+    simm_select(0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Adaptive sweeps
+//
+// Short delays show no decay and long ones show total decay, so once
+// a delay has been saturated for a few sweeps in a row, we skip it,
+// and spend the time on extra experiments around the median decay
+// time, where the model fit is most informative. Every so often we
+// run the full sweep again, in case things (like the temperature)
+// have changed.
+//
+
+#define N_DELAYS 24
+#define SATURATED_RUNS 4
+#define RECHECK_SWEEPS 8
+#define TESTED_BITS (0x40 * 0x40 * 8U)
+
+struct delay_stats {
+    unsigned delay_s;
+    unsigned runs;
+    unsigned long flips;
+    // Consecutive runs with no decay, or total decay.
+    unsigned char zero_runs;
+    unsigned char full_runs;
+};
+
+static struct delay_stats delay_stats[N_DELAYS];
+static unsigned sweep_count;
+
+// The standard sweep: 2^i seconds, interleaved with sqrt(2) * 2^i.
+// Go up to around 40 minutes (2048 seconds).
+static void init_delays(void)
+{
+    for (int i = 0; i < N_DELAYS / 2; i++) {
+        delay_stats[2 * i].delay_s = 1U << i;
+        delay_stats[2 * i + 1].delay_s = 46340 >> (15 - i); // Sqrt 2 * 2^15.
+    }
+}
+
+static char saturated(const struct delay_stats *st)
+{
+    return st->zero_runs >= SATURATED_RUNS || st->full_runs >= SATURATED_RUNS;
+}
+
+static void run_delay(unsigned delay_s)
+{
+    led_on();
+    test_decays(0x00, delay_s);
+    led_off();
+}
+
+// A delay is only saturated once it's saturated on every module.
+static void update_stats(struct delay_stats *st)
+{
+    char zero = 1;
+    char full = 1;
+    for (int m = 0; m < N_MODULES; m++) {
+        unsigned bits = last_results[m].bit_count;
+        st->runs++;
+        st->flips += bits;
+        zero &= bits == 0;
+        full &= bits == TESTED_BITS;
+    }
+    st->zero_runs = zero ? st->zero_runs + 1 : 0;
+    st->full_runs = full ? st->full_runs + 1 : 0;
+}
+
+// Estimate the median decay time, interpolating between the delays
+// either side of half the bits decaying. Returns 0 if we can't tell.
+static unsigned long estimate_median(void)
+{
+    const struct delay_stats *lo = 0;
+    for (int i = 0; i < N_DELAYS; i++) {
+        const struct delay_stats *st = &delay_stats[i];
+        if (st->runs == 0) {
+            continue;
+        }
+        unsigned long avg = st->flips / st->runs;
+        if (avg >= TESTED_BITS / 2) {
+            if (lo == 0) {
+                return 0;
+            }
+            unsigned long lo_avg = lo->flips / lo->runs;
+            return lo->delay_s + (unsigned long)(st->delay_s - lo->delay_s) *
+                (TESTED_BITS / 2 - lo_avg) / (avg - lo_avg);
+        }
+        lo = st;
+    }
+    return 0;
+}
+
+// Extra delays around the median, as a fraction of it (in 1000ths):
+// 2^(k/4) for k = 0, -1, 1, -2, 2.
+static const unsigned median_steps[] = { 1000, 841, 1189, 707, 1414 };
+
+void adaptive_sweep(void)
+{
+    char recheck = sweep_count % RECHECK_SWEEPS == 0;
+    unsigned long budget_s = 0;
+    unsigned skipped = 0;
+
+    for (int i = 0; i < N_DELAYS; i++) {
+        struct delay_stats *st = &delay_stats[i];
+        if (!recheck && saturated(st)) {
+            budget_s += st->delay_s;
+            skipped++;
+            continue;
+        }
+        run_delay(st->delay_s);
+        update_stats(st);
+    }
+
+    // Spend the time saved around the median.
+    unsigned long median = estimate_median();
+    print("Sweep: ");
+    pdecimal(sweep_count);
+    print(", skipped ");
+    pdecimal(skipped);
+    print(", median ");
+    pdecimal(median);
+    print("s\n");
+    if (median != 0) {
+        char ran = 1;
+        while (ran) {
+            ran = 0;
+            for (int k = 0; k < sizeof(median_steps) / sizeof(median_steps[0]); k++) {
+                unsigned long d = median * median_steps[k] / 1000;
+                if (d == 0 || d > budget_s || d > 0xffff) {
+                    continue;
+                }
+                run_delay(d);
+                budget_s -= d;
+                ran = 1;
+            }
+        }
+    }
+
+    sweep_count++;
+}
+
 int main(void)
 {
     // Even at fastest speeds, a 70ns SIMM, like I have, can happily
@@ -267,9 +1355,12 @@ int main(void)
     //
     // CPU prescale must be set with interrupts disabled. They're off
     // when the CPU starts.
-    cpu_prescale(CLOCK_SPEED);
+    set_clock(CLOCK_SPEED);
     led_init();
     simm_init();
+#if ECC
+    ecc_init();
+#endif
 
     // Initialise USB for debug, but don't wait.
     usb_init();
@@ -277,9 +1368,24 @@ int main(void)
     // And give us some time to enable logging.
     _delay_ms(5000);
 
+#if CALIBRATE
+    calibrate();
+#endif
+    // Start profiling (if enabled) once calibration's out of the way.
+    prof_init();
+    init_delays();
+
     // See how the memory decays without refresh.
     while (1) {
-#if TEST_DECAYS
+#if SCREEN
+        led_on();
+        screen();
+        led_off();
+#elif TEST_DECAYS && ADAPTIVE_SWEEP
+        adaptive_sweep();
+        // Per-sweep stats, if profiling is enabled.
+        prof_report();
+#elif TEST_DECAYS
         // Write, wait 2^i seconds, read, and report the read data.
         // Go up to around 40 minutes (2048 seconds).
         for (int i = 0; i < 12; i++) {
@@ -296,6 +1402,8 @@ int main(void)
             test_decays(0x00, delay_s);
 #endif
         }
+        // Per-sweep stats, if profiling is enabled.
+        prof_report();
 #else
         test_read_write();
         print("DONE\n");
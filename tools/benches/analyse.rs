@@ -0,0 +1,156 @@
+//
+// Benchmarks for simm_analyse: parsing and table generation over a
+// deterministic synthetic corpus, so that performance work on the
+// analyser can be judged against fixed numbers.
+//
+// Run with e.g. "cargo bench --bench analyse -- --size 1G --iters 3".
+// The corpus is generated by the simulator (see sim.rs) and cached under
+// the target directory, so repeated runs don't pay for it.
+//
+
+extern crate simm_analyse;
+
+use simm_analyse::sim::{parse_size, simulate, Config};
+use simm_analyse::{generate_corruptability, generate_flip_rates, parse_log};
+use std::env;
+use std::fs::{self, File};
+use std::io::{self, BufWriter, Write};
+use std::path::PathBuf;
+use std::process;
+use std::time::{Duration, Instant};
+
+struct Args {
+    size: u64,
+    seed: u64,
+    iters: usize,
+    only: Option<String>,
+}
+
+fn usage() -> ! {
+    eprintln!("Usage: cargo bench --bench analyse -- [--size N[K|M|G]] [--seed N] [--iters N] [--only NAME]");
+    process::exit(1);
+}
+
+fn parse_args() -> Args {
+    let mut args = Args { size: 10 << 20, seed: 1, iters: 3, only: None };
+    let mut argv = env::args().skip(1);
+    while let Some(arg) = argv.next() {
+        let mut value = || argv.next().unwrap_or_else(|| usage());
+        match arg.as_str() {
+            "--size" => args.size = parse_size(&value()).unwrap_or_else(|| usage()),
+            "--seed" => args.seed = value().parse().unwrap_or_else(|_| usage()),
+            "--iters" => args.iters = value().parse().unwrap_or_else(|_| usage()),
+            "--only" => args.only = Some(value()),
+            // Passed by "cargo bench".
+            "--bench" => (),
+            _ => usage(),
+        }
+    }
+    args
+}
+
+// Bump whenever the simulator's output changes for a given seed, so
+// that a corpus cached by an older version isn't benchmarked instead.
+const CORPUS_VERSION: u32 = 2;
+
+// Generate the corpus, unless we already have it.
+fn corpus(args: &Args) -> io::Result<PathBuf> {
+    let path = PathBuf::from(env!("CARGO_TARGET_TMPDIR"))
+        .join(format!("corpus_v{}_{}_{}.txt", CORPUS_VERSION, args.seed, args.size));
+    if !path.exists() {
+        eprintln!("Generating {}...", path.display());
+        let config = Config { seed: args.seed, max_bytes: Some(args.size), ..Config::default() };
+        let tmp = path.with_extension("tmp");
+        let mut out = BufWriter::with_capacity(1 << 20, File::create(&tmp)?);
+        simulate(&config, &mut out)?;
+        out.flush()?;
+        fs::rename(&tmp, &path)?;
+    }
+    Ok(path)
+}
+
+////////////////////////////////////////////////////////////////////////
+// Peak memory, from the kernel's high water mark. Linux-only; we
+// report nothing elsewhere.
+//
+
+fn reset_peak_memory() {
+    // Writing 5 to clear_refs resets VmHWM to the current RSS.
+    let _ = fs::write("/proc/self/clear_refs", "5");
+}
+
+fn peak_memory_mb() -> Option<f64> {
+    let status = fs::read_to_string("/proc/self/status").ok()?;
+    let line = status.lines().find(|l| l.starts_with("VmHWM:"))?;
+    let kb = line.split_whitespace().nth(1)?.parse::<f64>().ok()?;
+    Some(kb / 1024.0)
+}
+
+////////////////////////////////////////////////////////////////////////
+// Timing.
+//
+
+struct Bench {
+    bytes: u64,
+    // Unknown until the corpus has been parsed.
+    experiments: Option<usize>,
+    iters: usize,
+    only: Option<String>,
+}
+
+impl Bench {
+    // Run f the requested number of times, reporting the fastest.
+    fn run<T, F: FnMut() -> T>(&self, name: &str, mut f: F) -> Option<T> {
+        if self.only.as_ref().map_or(false, |o| o != name) {
+            return None;
+        }
+        let mut best = Duration::MAX;
+        let mut peak = None;
+        let mut result = None;
+        for _ in 0..self.iters {
+            // Drop the last result first, so it doesn't count.
+            drop(result.take());
+            reset_peak_memory();
+            let start = Instant::now();
+            let r = f();
+            best = best.min(start.elapsed());
+            peak = peak_memory_mb();
+            result = Some(r);
+        }
+        let secs = best.as_secs_f64();
+        println!("{:<16} {:>10.3} s {:>10.1} MB/s {:>12} experiments/s {:>10} MB peak",
+                 name,
+                 secs,
+                 self.bytes as f64 / (1 << 20) as f64 / secs,
+                 self.experiments.map_or("-".to_string(), |e| format!("{:.0}", e as f64 / secs)),
+                 peak.map_or("-".to_string(), |p| format!("{:.1}", p)));
+        result
+    }
+}
+
+fn main() -> io::Result<()> {
+    let args = parse_args();
+    let path = corpus(&args)?;
+    let bytes = fs::metadata(&path)?.len();
+
+    println!("Corpus: {} ({} bytes), best of {}", path.display(), bytes, args.iters.max(1));
+
+    let mut bench = Bench {
+        bytes,
+        experiments: None,
+        iters: args.iters.max(1),
+        only: args.only.clone(),
+    };
+    // The buffer the later benchmarks use is the one read here, so
+    // that "read" isn't measured with a second copy already in memory.
+    let buffer = match bench.run("read", || fs::read_to_string(&path).unwrap()) {
+        Some(buffer) => buffer,
+        None => fs::read_to_string(&path)?,
+    };
+    let entries = parse_log(&buffer).expect("Parse error");
+    bench.experiments = Some(entries.len());
+    bench.run("parse", || parse_log(&buffer).unwrap().len());
+    bench.run("corruptability", || generate_corruptability(&entries, &mut io::sink()).unwrap());
+    bench.run("flip_rates", || generate_flip_rates(&entries, &mut io::sink()).unwrap());
+    Ok(())
+}
@@ -0,0 +1,389 @@
+//
+// simm_capture: Capture the Teensy's debug output to log files,
+// replacing hid_listen redirected to a file.
+//
+// Reads the usb_debug_only HID interface via /dev/hidraw* (or any
+// file or pipe, for testing), splits the stream into records on the
+// "----" separator lines, tags each with a host timestamp, and writes
+// them to rotating log files that simm_analyse can read directly.
+//
+// A reader thread does nothing but read reports into a preallocated
+// ring of slots, so a slow disk (or fsync) never stalls it. Each read
+// of a hidraw device returns a single 32-byte report, so a slot holds
+// one report. The default 256K slots hold over 4 minutes of the
+// device's fastest output, a report per millisecond, so nothing is
+// dropped unless the disk stops for longer than that.
+//
+
+use std::env;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, BufWriter, Read, Write};
+use std::path::PathBuf;
+use std::process;
+use std::sync::{Condvar, Mutex};
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+const SEPARATOR: &str = "--------------------------------";
+
+// Big enough for a full-speed HID report. Pipes and files are read in
+// chunks of this size too, which is plenty fast enough for them.
+const SLOT_BYTES: usize = 64;
+
+struct Config {
+    input: PathBuf,
+    out_dir: PathBuf,
+    prefix: String,
+    rotate_bytes: u64,
+    fsync_interval: Duration,
+    slots: usize,
+}
+
+fn usage() -> ! {
+    eprintln!("Usage: simm_capture [options] [input]");
+    eprintln!("  input                  hidraw device, file or pipe (default /dev/hidraw0, - for stdin)");
+    eprintln!("  --out-dir DIR          Where to write logs (default .)");
+    eprintln!("  --prefix NAME          Log file name prefix (default capture)");
+    eprintln!("  --rotate-bytes N       Start a new log after this many bytes (default 64M)");
+    eprintln!("  --fsync-ms N           Sync logs to disk this often (default 1000)");
+    eprintln!("  --slots N              Ring buffer slots, a report each (default 262144)");
+    process::exit(1);
+}
+
+fn parse_args() -> Config {
+    let mut config = Config {
+        input: PathBuf::from("/dev/hidraw0"),
+        out_dir: PathBuf::from("."),
+        prefix: "capture".to_string(),
+        rotate_bytes: 64 << 20,
+        fsync_interval: Duration::from_millis(1000),
+        slots: 1 << 18,
+    };
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = || args.next().unwrap_or_else(|| usage());
+        match arg.as_str() {
+            "--out-dir" => config.out_dir = PathBuf::from(value()),
+            "--prefix" => config.prefix = value(),
+            "--rotate-bytes" => {
+                config.rotate_bytes = simm_analyse::sim::parse_size(&value()).unwrap_or_else(|| usage())
+            }
+            "--fsync-ms" => {
+                config.fsync_interval =
+                    Duration::from_millis(value().parse().unwrap_or_else(|_| usage()))
+            }
+            "--slots" => config.slots = value().parse::<usize>().unwrap_or_else(|_| usage()).max(2),
+            s if s.starts_with("--") => usage(),
+            s => config.input = PathBuf::from(s),
+        }
+    }
+    config
+}
+
+////////////////////////////////////////////////////////////////////////
+// Ring buffer of slots, filled by the reader and drained by the
+// writer. Each slot has its own lock so that filling one never
+// contends with draining another.
+//
+
+struct Slot {
+    len: usize,
+    // When the data arrived, in seconds since the epoch.
+    time: f64,
+    // First data since the device came back, so anything before it
+    // was cut off.
+    reconnected: bool,
+    data: [u8; SLOT_BYTES],
+}
+
+struct RingState {
+    head: usize, // Next to fill.
+    len: usize,  // Filled, not yet drained.
+    done: bool,  // Reader has finished.
+}
+
+struct Ring {
+    slots: Vec<Mutex<Slot>>,
+    state: Mutex<RingState>,
+    changed: Condvar,
+}
+
+impl Ring {
+    fn new(n: usize) -> Ring {
+        Ring {
+            slots: (0..n)
+                .map(|_| Mutex::new(Slot { len: 0, time: 0.0, reconnected: false, data: [0; SLOT_BYTES] }))
+                .collect(),
+            state: Mutex::new(RingState { head: 0, len: 0, done: false }),
+            changed: Condvar::new(),
+        }
+    }
+
+    // Wait for a free slot, and return its index.
+    fn free_slot(&self) -> usize {
+        let mut state = self.state.lock().unwrap();
+        while state.len == self.slots.len() {
+            state = self.changed.wait(state).unwrap();
+        }
+        state.head
+    }
+
+    fn push(&self) {
+        let mut state = self.state.lock().unwrap();
+        state.head = (state.head + 1) % self.slots.len();
+        state.len += 1;
+        self.changed.notify_all();
+    }
+
+    fn finish(&self) {
+        self.state.lock().unwrap().done = true;
+        self.changed.notify_all();
+    }
+
+    // Wait until there's something to drain, or we time out, and
+    // return the (tail, count) filled, or None if we're done.
+    fn filled(&self, timeout: Duration) -> Option<(usize, usize)> {
+        let mut state = self.state.lock().unwrap();
+        if state.len == 0 && !state.done {
+            state = self.changed.wait_timeout(state, timeout).unwrap().0;
+        }
+        if state.len == 0 && state.done {
+            return None;
+        }
+        let n = self.slots.len();
+        Some(((state.head + n - state.len) % n, state.len))
+    }
+
+    fn pop(&self, count: usize) {
+        let mut state = self.state.lock().unwrap();
+        state.len -= count;
+        self.changed.notify_all();
+    }
+}
+
+fn now() -> f64 {
+    SystemTime::now().duration_since(UNIX_EPOCH).map_or(0.0, |d| d.as_secs_f64())
+}
+
+// Read from the input until it ends. A hidraw device goes away when
+// the Teensy is reset or unplugged, so for devices we wait for it to
+// come back, rather than giving up.
+fn reader(config: &Config, ring: &Ring) {
+    let is_device = config.input.starts_with("/dev/");
+    let mut opened = false;
+    loop {
+        let mut input: Box<dyn Read> = if config.input == PathBuf::from("-") {
+            Box::new(io::stdin())
+        } else {
+            match File::open(&config.input) {
+                Ok(f) => Box::new(f),
+                Err(e) if is_device => {
+                    eprintln!("simm_capture: {}: {}, retrying", config.input.display(), e);
+                    thread::sleep(Duration::from_secs(1));
+                    continue;
+                }
+                Err(e) => {
+                    eprintln!("simm_capture: {}: {}", config.input.display(), e);
+                    break;
+                }
+            }
+        };
+        let mut reconnected = opened;
+        opened = true;
+
+        loop {
+            let idx = ring.free_slot();
+            let mut slot = ring.slots[idx].lock().unwrap();
+            match input.read(&mut slot.data[..]) {
+                Ok(0) => break,
+                Ok(n) => {
+                    slot.len = n;
+                    slot.time = now();
+                    slot.reconnected = reconnected;
+                    reconnected = false;
+                    drop(slot);
+                    ring.push();
+                }
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                Err(e) => {
+                    eprintln!("simm_capture: {}: {}", config.input.display(), e);
+                    break;
+                }
+            }
+        }
+        if !is_device {
+            break;
+        }
+    }
+    ring.finish();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Writer: reassemble lines, split records, and write rotating logs.
+//
+
+struct Logs<'a> {
+    config: &'a Config,
+    out: Option<BufWriter<File>>,
+    path: PathBuf,
+    written: u64,
+    seq: usize,
+    records_in_file: usize,
+    last_sync: Instant,
+}
+
+impl<'a> Logs<'a> {
+    fn new(config: &'a Config) -> Logs<'a> {
+        Logs {
+            config,
+            out: None,
+            path: PathBuf::new(),
+            written: 0,
+            seq: 0,
+            records_in_file: 0,
+            last_sync: Instant::now(),
+        }
+    }
+
+    fn open(&mut self) -> io::Result<()> {
+        self.path = self.config.out_dir.join(format!(
+            "{}_{}_{:04}.txt", self.config.prefix, now() as u64, self.seq));
+        self.seq += 1;
+        let file = OpenOptions::new().create_new(true).write(true).open(&self.path)?;
+        eprintln!("simm_capture: writing {}", self.path.display());
+        self.out = Some(BufWriter::with_capacity(1 << 20, file));
+        self.written = 0;
+        self.records_in_file = 0;
+        Ok(())
+    }
+
+    fn close(&mut self) -> io::Result<()> {
+        if let Some(mut out) = self.out.take() {
+            out.flush()?;
+            out.get_ref().sync_data()?;
+        }
+        Ok(())
+    }
+
+    // Records are separated, not terminated, by the separator, just
+    // like the logs in results/, so every file parses on its own.
+    // Files only rotate between records.
+    fn write_record(&mut self, record: &str) -> io::Result<()> {
+        if self.out.is_some() && self.written >= self.config.rotate_bytes {
+            self.close()?;
+        }
+        if self.out.is_none() {
+            self.open()?;
+        }
+        let out = self.out.as_mut().unwrap();
+        if self.records_in_file != 0 {
+            writeln!(out, "{}", SEPARATOR)?;
+            self.written += SEPARATOR.len() as u64 + 1;
+        }
+        out.write_all(record.as_bytes())?;
+        self.written += record.len() as u64;
+        self.records_in_file += 1;
+        Ok(())
+    }
+
+    // Hand what we have to the kernel once per batch, so little is
+    // lost if we're killed, but batch up the syncs to disk.
+    fn flush(&mut self) -> io::Result<()> {
+        if let Some(out) = self.out.as_mut() {
+            out.flush()?;
+            if self.last_sync.elapsed() >= self.config.fsync_interval {
+                out.get_ref().sync_data()?;
+                self.last_sync = Instant::now();
+            }
+        }
+        Ok(())
+    }
+}
+
+// Write out a record that never got its separator, if it's complete,
+// i.e. has its "Diffs" line, and drop it otherwise, as it wouldn't
+// parse.
+fn end_record(logs: &mut Logs, record: &mut String, time: f64) -> io::Result<()> {
+    if record.lines().any(|l| l.starts_with("Diffs: ")) {
+        record.push_str(&format!("Host: {:.3}\n", time));
+        logs.write_record(record)?;
+    } else if !record.trim().is_empty() {
+        eprintln!("simm_capture: dropping incomplete record");
+    }
+    record.clear();
+    Ok(())
+}
+
+fn writer(config: &Config, ring: &Ring) -> io::Result<()> {
+    fs::create_dir_all(&config.out_dir)?;
+    let mut logs = Logs::new(config);
+    let mut line: Vec<u8> = Vec::with_capacity(1024);
+    let mut record = String::with_capacity(4096);
+    let mut record_time = 0.0;
+
+    while let Some((tail, count)) = ring.filled(config.fsync_interval) {
+        for i in 0..count {
+            let slot = ring.slots[(tail + i) % ring.slots.len()].lock().unwrap();
+            // The Teensy was reset, and starts again from scratch, so
+            // don't join its output onto whatever was cut off.
+            if slot.reconnected {
+                eprintln!("simm_capture: device reconnected");
+                line.clear();
+                end_record(&mut logs, &mut record, record_time)?;
+            }
+            for &b in slot.data[..slot.len].iter() {
+                match b {
+                    // Reports are padded with NULs, and print_P sends
+                    // CR LF, where the logs just have LF.
+                    0 | b'\r' => (),
+                    b'\n' => {
+                        let text = String::from_utf8_lossy(&line);
+                        if text == SEPARATOR {
+                            // Nothing to say about an empty record,
+                            // e.g. one that was cut off by a reset.
+                            if !record.trim().is_empty() {
+                                record.push_str(&format!("Host: {:.3}\n", record_time));
+                                logs.write_record(&record)?;
+                            }
+                            record.clear();
+                        } else {
+                            if record.is_empty() {
+                                record_time = slot.time;
+                            }
+                            record.push_str(&text);
+                            record.push('\n');
+                        }
+                        line.clear();
+                    }
+                    _ => line.push(b),
+                }
+            }
+        }
+        ring.pop(count);
+        logs.flush()?;
+    }
+
+    // Keep a complete final record (e.g. the stream was cut just
+    // before the separator).
+    if !line.is_empty() {
+        record.push_str(&String::from_utf8_lossy(&line));
+        record.push('\n');
+    }
+    end_record(&mut logs, &mut record, record_time)?;
+    logs.close()
+}
+
+fn main() {
+    let config = parse_args();
+    let ring = Ring::new(config.slots);
+
+    thread::scope(|s| {
+        s.spawn(|| reader(&config, &ring));
+        if let Err(e) = writer(&config, &ring) {
+            // Don't wait for the reader, which may be blocked on the
+            // device.
+            eprintln!("simm_capture: {}", e);
+            process::exit(1);
+        }
+    });
+}
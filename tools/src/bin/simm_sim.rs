@@ -0,0 +1,98 @@
+//
+// simm_sim: Monte Carlo simulation of DRAM decay, producing synthetic
+// logs in the same format as the Teensy firmware. See sim.rs for the
+// model.
+//
+
+extern crate simm_analyse;
+
+use simm_analyse::sim::{parse_size, refresh_table, simulate, Config};
+use std::env;
+use std::io::{self, BufWriter, Write};
+use std::process;
+
+fn usage() -> ! {
+    eprintln!("Usage: simm_sim [options]");
+    eprintln!("  --rows N, --cols N     Array size in bytes (default 64 x 64)");
+    eprintln!("  --mu X, --sigma X      ln(RC seconds) distribution (default ln(180), 0.357)");
+    eprintln!("  --tail-frac F          Fraction of cells in the fat tail (default 0)");
+    eprintln!("  --tail-mu X, --tail-sigma X  Tail distribution (default ln(30), 1.0)");
+    eprintln!("  --jitter X             Per-experiment ln(RC) jitter (default 0.05)");
+    eprintln!("  --delays a,b,...       Sweep delays in seconds (default: firmware sweep)");
+    eprintln!("  --runs N               Number of sweeps (default 1)");
+    eprintln!("  --size N[K|M|G]        Instead, generate a log of about this size");
+    eprintln!("  --seed N               Module/experiment seed (default 1)");
+    eprintln!("  --threads N            Worker threads (default: all cores)");
+    eprintln!("  --summary              Print flip rates per delay instead of a log");
+    eprintln!("  --refresh              Print refresh failure probabilities instead");
+    eprintln!("  --memory-bits N        Memory size for --refresh (default 8Mi)");
+    eprintln!("  --modules N            Virtual SIMMs tested together (default 1)");
+    process::exit(1);
+}
+
+fn parse_args() -> Config {
+    let mut config = Config::default();
+
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = || args.next().unwrap_or_else(|| usage());
+        fn num<T: std::str::FromStr>(s: String) -> T {
+            s.parse::<T>().unwrap_or_else(|_| usage())
+        }
+        match arg.as_str() {
+            "--rows" => config.rows = num(value()),
+            "--cols" => config.cols = num(value()),
+            "--mu" => config.mu = num(value()),
+            "--sigma" => config.sigma = num(value()),
+            "--tail-frac" => config.tail_frac = num(value()),
+            "--tail-mu" => config.tail_mu = num(value()),
+            "--tail-sigma" => config.tail_sigma = num(value()),
+            "--jitter" => config.jitter = num(value()),
+            "--delays" => {
+                config.delays = value().split(',').map(|s| num(s.to_string())).collect()
+            }
+            "--runs" => config.runs = num(value()),
+            "--size" => config.max_bytes = Some(parse_size(&value()).unwrap_or_else(|| usage())),
+            "--seed" => config.seed = num(value()),
+            "--threads" => config.threads = num::<usize>(value()).max(1),
+            "--summary" => config.summary = true,
+            "--refresh" => config.refresh = true,
+            "--memory-bits" => config.memory_bits = num(value()),
+            "--modules" => config.modules = num::<usize>(value()).max(1),
+            _ => usage(),
+        }
+    }
+
+    if config.rows == 0 || config.cols == 0 || config.delays.is_empty() {
+        usage();
+    }
+    // A summary has no size, so would never finish.
+    if config.summary && config.max_bytes.is_some() {
+        eprintln!("--size only applies to logs, use --runs with --summary.");
+        process::exit(1);
+    }
+    // The firmware prints each of row and column as a single hex byte.
+    if !config.summary && !config.refresh && (config.rows > 0x100 || config.cols > 0x100) {
+        eprintln!("Logs only support up to 256 rows and columns, use --summary.");
+        process::exit(1);
+    }
+    config
+}
+
+fn main() {
+    let config = parse_args();
+    let stdout = io::stdout();
+    let mut out = BufWriter::with_capacity(1 << 20, stdout.lock());
+    let result = if config.refresh {
+        refresh_table(&config, &mut out)
+    } else {
+        simulate(&config, &mut out)
+    }.and_then(|_| out.flush());
+    if let Err(e) = result {
+        // Closed pipes (e.g. into head) are not worth complaining about.
+        if e.kind() != io::ErrorKind::BrokenPipe {
+            eprintln!("simm_sim: {}", e);
+            process::exit(1);
+        }
+    }
+}
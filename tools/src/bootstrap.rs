@@ -0,0 +1,337 @@
+//
+// Bootstrap confidence intervals for the flip rates, and for the
+// log-normal model's median and spread fitted to them.
+//
+// Experiments in the same sweep share a temperature and a stretch of
+// time, so they aren't independent. Rather than resampling single
+// experiments, we resample whole sweeps (a block bootstrap). Each
+// resample is just a sum of per-sweep counts, so thousands of them
+// take well under a second, spread over all cores.
+//
+
+use std::io::{self, Write};
+use std::thread;
+
+use crate::rng::hash;
+use crate::sim::normal_cdf;
+use crate::{Entry, TESTED_BITS};
+
+// Decayed bits and experiments at each delay.
+#[derive(Clone, Copy, Debug, Default)]
+struct Count {
+    bits: u64,
+    experiments: u64,
+}
+
+// Split the log into sweeps, each a run of increasing delays. In
+// adaptive sweeps, the extra delays around the median start new
+// blocks of their own, which still only groups neighbouring
+// experiments together.
+fn sweeps(stats: &[Entry], delays: &[usize]) -> Vec<Vec<Count>> {
+    let mut blocks: Vec<Vec<Count>> = Vec::new();
+    let mut last = usize::MAX;
+    for entry in stats.iter() {
+        if blocks.is_empty() || entry.delay < last {
+            blocks.push(vec![Count::default(); delays.len()]);
+        }
+        last = entry.delay;
+        let c = &mut blocks.last_mut().unwrap()[delays.binary_search(&entry.delay).unwrap()];
+        c.bits += entry.bit_count as u64;
+        c.experiments += 1;
+    }
+    blocks
+}
+
+fn flip_rates(counts: &[Count]) -> Vec<f64> {
+    counts
+        .iter()
+        .map(|c| c.bits as f64 / (c.experiments * TESTED_BITS as u64) as f64)
+        .collect()
+}
+
+// Inverse of normal_cdf, by bisection. Only used for starting
+// points, so speed doesn't matter.
+fn normal_quantile(p: f64) -> f64 {
+    let (mut lo, mut hi) = (-40.0, 40.0);
+    for _ in 0..64 {
+        let mid = 0.5 * (lo + hi);
+        if normal_cdf(mid) < p {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    0.5 * (lo + hi)
+}
+
+// Binomial log likelihood of the model eta = a + b ln t.
+fn log_likelihood(points: &[(f64, f64, f64)], a: f64, b: f64) -> f64 {
+    points
+        .iter()
+        .map(|&(x, k, n)| {
+            let eta = a + b * x;
+            let mut l = 0.0;
+            if k > 0.0 {
+                l += k * normal_cdf(eta).ln();
+            }
+            if k < n {
+                l += (n - k) * normal_cdf(-eta).ln();
+            }
+            l
+        })
+        .sum()
+}
+
+// Maximum likelihood fit of the README's model, in which the fraction
+// of bits decayed after t is Phi((ln t - mu) / sigma), by Fisher
+// scoring on the probit scale, halving steps that don't improve the
+// likelihood. Returns the median decay time, e^mu, in the log's delay
+// units, and sigma, or None if the data can't pin them down (e.g. no
+// decay at all).
+pub fn fit_lognormal(delays: &[usize], counts: &[(u64, u64)]) -> Option<(f64, f64)> {
+    let points = delays
+        .iter()
+        .zip(counts.iter())
+        .filter(|&(_, &(_, n))| n > 0)
+        .map(|(&d, &(k, n))| ((d as f64).ln(), k as f64, n as f64))
+        .collect::<Vec<_>>();
+    if !points.iter().any(|&(_, k, _)| k > 0.0) || !points.iter().any(|&(_, k, n)| k < n) {
+        return None;
+    }
+
+    // Start from a straight line through the probits of the partly
+    // decayed points, if there are enough of them, or else the
+    // README's spread, centred on the first delay where anything
+    // decayed.
+    let partial = points
+        .iter()
+        .filter(|&&(_, k, n)| k > 0.0 && k < n)
+        .map(|&(x, k, n)| (x, normal_quantile(k / n)))
+        .collect::<Vec<_>>();
+    let m = partial.len() as f64;
+    let (sx, sz) = partial.iter().fold((0.0, 0.0), |(sx, sz), &(x, z)| (sx + x, sz + z));
+    let sxx = partial.iter().map(|&(x, _)| (x - sx / m).powi(2)).sum::<f64>();
+    let sxz = partial.iter().map(|&(x, z)| (x - sx / m) * (z - sz / m)).sum::<f64>();
+    let (mut a, mut b) = if partial.len() >= 2 && sxz > 0.0 {
+        let b = sxz / sxx;
+        (sz / m - b * sx / m, b)
+    } else {
+        let x0 = points.iter().find(|&&(_, k, _)| k > 0.0).unwrap().0;
+        (-(x0 + 2.0 * 0.357) / 0.357, 1.0 / 0.357)
+    };
+    let mut ll = log_likelihood(&points, a, b);
+
+    for _ in 0..100 {
+        // Weighted least squares of the working response on x.
+        let (mut sw, mut swx, mut swz, mut swxx, mut swxz) = (0.0, 0.0, 0.0, 0.0, 0.0);
+        for &(x, k, n) in points.iter() {
+            let eta = a + b * x;
+            let p = normal_cdf(eta);
+            let q = normal_cdf(-eta);
+            let phi = (-0.5 * eta * eta).exp() / (2.0 * std::f64::consts::PI).sqrt();
+            if p <= 0.0 || q <= 0.0 || phi <= 0.0 {
+                continue;
+            }
+            let w = n * phi * phi / (p * q);
+            let z = eta + (k / n - p) / phi;
+            sw += w;
+            swx += w * x;
+            swz += w * z;
+            swxx += w * x * x;
+            swxz += w * x * z;
+        }
+        let det = sw * swxx - swx * swx;
+        if !(det > 0.0) {
+            return None;
+        }
+        let b_full = (sw * swxz - swx * swz) / det;
+        let a_full = (swz - b_full * swx) / sw;
+
+        let mut step = 1.0;
+        let (mut a_new, mut b_new, mut ll_new);
+        loop {
+            a_new = a + step * (a_full - a);
+            b_new = b + step * (b_full - b);
+            ll_new = log_likelihood(&points, a_new, b_new);
+            if ll_new >= ll || step < 1e-6 {
+                break;
+            }
+            step *= 0.5;
+        }
+        if !(ll_new >= ll) {
+            break;
+        }
+        let converged = ll_new - ll < 1e-9 * ll.abs().max(1.0);
+        a = a_new;
+        b = b_new;
+        ll = ll_new;
+        if converged {
+            break;
+        }
+    }
+
+    if b > 0.0 && a.is_finite() {
+        Some(((-a / b).exp(), 1.0 / b))
+    } else {
+        None
+    }
+}
+
+// Everything we estimate from one (re)sample.
+struct Estimates {
+    rates: Vec<f64>,
+    fit: Option<(f64, f64)>,
+}
+
+fn estimate(delays: &[usize], counts: &[Count]) -> Estimates {
+    let fit_counts = counts
+        .iter()
+        .map(|c| (c.bits, c.experiments * TESTED_BITS as u64))
+        .collect::<Vec<_>>();
+    Estimates { rates: flip_rates(counts), fit: fit_lognormal(delays, &fit_counts) }
+}
+
+// Resample sweeps with replacement.
+fn resample(blocks: &[Vec<Count>], seed: u64, resample: u64) -> Vec<Count> {
+    let mut counts = vec![Count::default(); blocks[0].len()];
+    for j in 0..blocks.len() {
+        let block = &blocks[(hash(seed, resample, j as u64) % blocks.len() as u64) as usize];
+        for (c, b) in counts.iter_mut().zip(block.iter()) {
+            c.bits += b.bits;
+            c.experiments += b.experiments;
+        }
+    }
+    counts
+}
+
+// Percentile interval, ignoring resamples where the value is
+// undefined (e.g. no experiments at that delay were drawn).
+fn interval(mut values: Vec<f64>, level: f64) -> (f64, f64) {
+    values.retain(|v| v.is_finite());
+    if values.is_empty() {
+        return (f64::NAN, f64::NAN);
+    }
+    values.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    let at = |q: f64| values[((q * values.len() as f64) as usize).min(values.len() - 1)];
+    (at((1.0 - level) / 2.0), at((1.0 + level) / 2.0))
+}
+
+// With fewer sweeps than this, the resamples can only take a few
+// distinct values, and the intervals aren't worth much.
+const MIN_SWEEPS: usize = 10;
+
+pub struct Config {
+    pub resamples: usize,
+    pub seed: u64,
+    pub level: f64,
+    pub threads: usize,
+}
+
+pub fn generate_bootstrap<W: Write>(stats: &[Entry], config: &Config, out: &mut W) -> io::Result<()> {
+    let mut delays = stats.iter().map(|e| e.delay).collect::<Vec<_>>();
+    delays.sort();
+    delays.dedup();
+    let blocks = sweeps(stats, &delays);
+    if blocks.is_empty() {
+        return Ok(());
+    }
+    if blocks.len() < MIN_SWEEPS {
+        eprintln!("Warning: only {} sweeps, so the bootstrap intervals are unreliable.", blocks.len());
+    }
+
+    let mut total = vec![Count::default(); delays.len()];
+    for block in blocks.iter() {
+        for (t, b) in total.iter_mut().zip(block.iter()) {
+            t.bits += b.bits;
+            t.experiments += b.experiments;
+        }
+    }
+    let point = estimate(&delays, &total);
+
+    let per_thread = (config.resamples + config.threads - 1) / config.threads.max(1);
+    let resamples: Vec<Estimates> = thread::scope(|s| {
+        let handles = (0..config.resamples)
+            .step_by(per_thread.max(1))
+            .map(|start| {
+                let (delays, blocks) = (&delays, &blocks);
+                s.spawn(move || {
+                    (start..(start + per_thread).min(config.resamples))
+                        .map(|r| estimate(delays, &resample(blocks, config.seed, r as u64)))
+                        .collect::<Vec<_>>()
+                })
+            })
+            .collect::<Vec<_>>();
+        handles.into_iter().flat_map(|h| h.join().unwrap()).collect()
+    });
+
+    let pct = |q: f64| format!("{}%", (1000.0 * q).round() / 10.0);
+    let (lo_name, hi_name) = (pct((1.0 - config.level) / 2.0), pct((1.0 + config.level) / 2.0));
+
+    // Flip rates, laid out like generate_flip_rates, with a row for
+    // each end of the interval.
+    let rate_intervals = (0..delays.len())
+        .map(|d| interval(resamples.iter().map(|e| e.rates[d]).collect(), config.level))
+        .collect::<Vec<_>>();
+    let join = |v: Vec<String>| v.join(",");
+    writeln!(out, "delay,{}", join(delays.iter().map(|d| d.to_string()).collect()))?;
+    writeln!(out, "flip rate,{}", join(point.rates.iter().map(|r| r.to_string()).collect()))?;
+    writeln!(out, "{},{}", lo_name, join(rate_intervals.iter().map(|i| i.0.to_string()).collect()))?;
+    writeln!(out, "{},{}", hi_name, join(rate_intervals.iter().map(|i| i.1.to_string()).collect()))?;
+    writeln!(out)?;
+
+    // And the fitted parameters. Resamples the model couldn't be
+    // fitted to are left out of the intervals, so say how many.
+    let fits = resamples.iter().filter_map(|e| e.fit).collect::<Vec<_>>();
+    let (median, sigma) = point.fit.unwrap_or((f64::NAN, f64::NAN));
+    let median_ci = interval(fits.iter().map(|f| f.0).collect(), config.level);
+    let sigma_ci = interval(fits.iter().map(|f| f.1).collect(), config.level);
+    writeln!(out, ",estimate,{},{}", lo_name, hi_name)?;
+    writeln!(out, "median,{},{},{}", median, median_ci.0, median_ci.1)?;
+    writeln!(out, "sigma,{},{},{}", sigma, sigma_ci.0, sigma_ci.1)?;
+    writeln!(out, "sweeps,{}", blocks.len())?;
+    writeln!(out, "resamples,{}", config.resamples)?;
+    writeln!(out, "failed fits,{}", config.resamples - fits.len())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::sim::{cell_decay_probability, Config};
+
+    #[test]
+    fn sweeps_split_on_a_delay_drop() {
+        let delays = [1, 2, 4];
+        let entry = |delay, bit_count| Entry { delay, corrupted: vec![], bit_count, ecc: None, module: 0 };
+        // A full sweep, a repeat of a delay, and a short one.
+        let stats = [entry(1, 0), entry(2, 3), entry(4, 10), entry(4, 12), entry(1, 1), entry(2, 5)];
+        let blocks = sweeps(&stats, &delays);
+        let counts = |b: &Vec<Count>| b.iter().map(|c| (c.bits, c.experiments)).collect::<Vec<_>>();
+        assert_eq!(blocks.len(), 2);
+        assert_eq!(counts(&blocks[0]), vec![(0, 1), (3, 1), (22, 2)]);
+        assert_eq!(counts(&blocks[1]), vec![(1, 1), (5, 1), (0, 0)]);
+    }
+
+    // With exact expected counts, the fit should land on the model
+    // they came from: the cell spread and the jitter, in quadrature.
+    #[test]
+    fn fit_lognormal_recovers_the_model() {
+        let config = Config::default();
+        let delays = config.delays.iter().map(|&d| d as usize).collect::<Vec<_>>();
+        let n = 1u64 << 30;
+        let counts = config
+            .delays
+            .iter()
+            .map(|&d| ((cell_decay_probability(&config, d as f64) * n as f64).round() as u64, n))
+            .collect::<Vec<_>>();
+        let (median, sigma) = fit_lognormal(&delays, &counts).unwrap();
+        let expected_sigma = (config.sigma.powi(2) + config.jitter.powi(2)).sqrt();
+        assert!((median / config.mu.exp() - 1.0).abs() < 1e-3, "median {}", median);
+        assert!((sigma / expected_sigma - 1.0).abs() < 1e-3, "sigma {}", sigma);
+    }
+
+    #[test]
+    fn fit_lognormal_needs_partial_decay() {
+        assert_eq!(fit_lognormal(&[1, 2], &[(0, 10), (0, 10)]), None);
+        assert_eq!(fit_lognormal(&[1, 2], &[(10, 10), (10, 10)]), None);
+    }
+}
@@ -0,0 +1,533 @@
+//
+// simm_analyse: Take a set of test run logs at a variety of
+// temperatures, and convert them into stats about the decay of memory
+// cells.
+//
+// The analysis lives in the library so that the benchmarks and other
+// tools can drive it; main.rs is just the command line wrapper.
+//
+
+extern crate memchr;
+
+pub mod bootstrap;
+pub mod rng;
+pub mod sim;
+pub mod survival;
+pub mod tensor;
+
+use std::collections::HashMap;
+use std::collections::HashSet;
+use std::fmt;
+use std::io::{self, Write};
+
+// The testing was done over 4K bytes, in 64 rows and columns.
+pub const TESTED_ROWS: usize = 0x40;
+pub const TESTED_COLS: usize = 0x40;
+pub const TESTED_BITS: usize = TESTED_ROWS * TESTED_COLS * 8;
+
+// The firmware only records the first 31 corrupt bytes.
+pub const MAX_RECORDED: usize = 31;
+
+// A corrupt location, as printed by the firmware as "RRCCMM": row,
+// column and xor mask, one hex byte each, packed into 0xRRCCMM. Packed
+// locations sort the same way as the strings.
+pub type Location = u32;
+
+pub fn location_row(l: Location) -> usize {
+    (l >> 16) as usize
+}
+
+pub fn location_col(l: Location) -> usize {
+    ((l >> 8) & 0xff) as usize
+}
+
+pub fn location_mask(l: Location) -> u8 {
+    l as u8
+}
+
+// Counts of ECC words from the firmware's ECC mode.
+#[derive(Clone, Copy, Debug)]
+pub struct Ecc {
+    pub words: usize,
+    pub corrected: usize,
+    pub uncorrectable: usize,
+}
+
+#[derive(Clone, Debug)]
+pub struct Entry {
+       pub delay: usize,
+       pub corrupted: Vec<Location>,
+       pub bit_count: usize,
+       pub ecc: Option<Ecc>,
+       // Which SIMM, when several are tested together.
+       pub module: usize,
+}
+
+////////////////////////////////////////////////////////////////////////
+// Log parsing.
+//
+// A log is a sequence of entries separated by lines of 32 dashes, each
+// of which looks like:
+//
+//   Delay: n, Pattern: m
+//   RRCCMM,RRCCMM,...,
+//   Diffs: n
+//
+// The firmware may print other things (e.g. calibration results)
+// before an entry's "Delay" line, and extra lines of other stats (e.g.
+// "Power: ...") after its "Diffs" line, which we skip, apart from
+// the "ECC" line printed in ECC mode, and the "Module" line when
+// testing several SIMMs at once. Raw firmware output also has a
+// separator after its last entry, perhaps followed by more stats, and
+// may end its lines with CR LF. The pattern is printed in hex.
+//
+// Logs can be big, so we make a single pass over the bytes, finding
+// line ends with memchr, and decode numbers and locations in place,
+// with no allocation beyond each entry's list of locations.
+//
+
+const SEPARATOR: &[u8] = b"--------------------------------";
+
+#[derive(Clone, Debug)]
+pub struct ParseError {
+    // 1-based line number in the log.
+    pub line: usize,
+    pub message: String,
+}
+
+impl fmt::Display for ParseError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "line {}: {}", self.line, self.message)
+    }
+}
+
+impl std::error::Error for ParseError {}
+
+fn error<T>(line: usize, message: &str) -> Result<T, ParseError> {
+    Err(ParseError { line, message: message.to_string() })
+}
+
+// Hex digit values, or 0xff for anything else.
+const HEX_VALUES: [u8; 256] = {
+    let mut table = [0xff; 256];
+    let mut i = 0;
+    while i < 10 {
+        table[b'0' as usize + i] = i as u8;
+        i += 1;
+    }
+    let mut i = 0;
+    while i < 6 {
+        table[b'A' as usize + i] = 10 + i as u8;
+        table[b'a' as usize + i] = 10 + i as u8;
+        i += 1;
+    }
+    table
+};
+
+// Parse a decimal number at the start of s, returning it and the
+// rest of s.
+fn parse_decimal(s: &[u8]) -> Option<(usize, &[u8])> {
+    let digits = s.iter().take_while(|b| b.is_ascii_digit()).count();
+    if digits == 0 {
+        return None;
+    }
+    let mut n: usize = 0;
+    for &b in s[..digits].iter() {
+        n = n.checked_mul(10)?.checked_add((b - b'0') as usize)?;
+    }
+    Some((n, &s[digits..]))
+}
+
+// "Delay: n, Pattern: m", returning n.
+fn parse_delay(line: &[u8]) -> Option<usize> {
+    let (delay, rest) = parse_decimal(line.strip_prefix(b"Delay: ")?)?;
+    let pattern = rest.strip_prefix(b", Pattern: ")?;
+    if !pattern.is_empty() && pattern.iter().all(|&b| HEX_VALUES[b as usize] != 0xff) {
+        Some(delay)
+    } else {
+        None
+    }
+}
+
+// "ECC: words n, corrected n, uncorrectable n".
+fn parse_ecc(line: &[u8]) -> Option<Ecc> {
+    let (words, rest) = parse_decimal(line.strip_prefix(b"ECC: words ")?)?;
+    let (corrected, rest) = parse_decimal(rest.strip_prefix(b", corrected ")?)?;
+    let (uncorrectable, rest) = parse_decimal(rest.strip_prefix(b", uncorrectable ")?)?;
+    if rest.is_empty() { Some(Ecc { words, corrected, uncorrectable }) } else { None }
+}
+
+// "Module: n", returning n.
+fn parse_module(line: &[u8]) -> Option<usize> {
+    match parse_decimal(line.strip_prefix(b"Module: ")?)? {
+        (n, b"") => Some(n),
+        _ => None,
+    }
+}
+
+// "Diffs: n", returning n.
+fn parse_diffs(line: &[u8]) -> Option<usize> {
+    match parse_decimal(line.strip_prefix(b"Diffs: ")?)? {
+        (n, b"") => Some(n),
+        _ => None,
+    }
+}
+
+// Comma-terminated "RRCCMM" locations.
+fn parse_locations(line: &[u8]) -> Option<Vec<Location>> {
+    if line.len() % 7 != 0 {
+        return None;
+    }
+    let mut locations = Vec::with_capacity(line.len() / 7);
+    for token in line.chunks_exact(7) {
+        if token[6] != b',' {
+            return None;
+        }
+        let mut l: Location = 0;
+        let mut bad = 0;
+        for &b in token[..6].iter() {
+            let v = HEX_VALUES[b as usize];
+            bad |= v;
+            l = l << 4 | (v & 15) as Location;
+        }
+        if bad & 0xf0 != 0 {
+            return None;
+        }
+        locations.push(l);
+    }
+    Some(locations)
+}
+
+// Where we are in the current entry.
+enum State {
+    // Skipping anything before the "Delay" line.
+    Start,
+    Locations { delay: usize },
+    Diffs { delay: usize, corrupted: Vec<Location> },
+    // Complete, skipping any extra lines up to the separator.
+    Done,
+}
+
+// Split a whole log file into its entries.
+pub fn parse_log(buffer: &str) -> Result<Vec<Entry>, ParseError> {
+    let buffer = buffer.as_bytes();
+    let mut entries = Vec::new();
+    let mut state = State::Start;
+    let mut pos = 0;
+    let mut line_no = 0;
+
+    while pos <= buffer.len() {
+        let end = memchr::memchr(b'\n', &buffer[pos..]).map_or(buffer.len(), |i| pos + i);
+        let line = &buffer[pos..end];
+        let line = line.strip_suffix(b"\r").unwrap_or(line);
+        pos = end + 1;
+        line_no += 1;
+
+        if line == SEPARATOR {
+            match state {
+                State::Done => (),
+                State::Start => return error(line_no, "entry has no \"Delay\" line"),
+                _ => return error(line_no, "entry ends before its \"Diffs\" line"),
+            }
+            state = State::Start;
+            continue;
+        }
+
+        state = match state {
+            State::Start => match parse_delay(line) {
+                Some(delay) => State::Locations { delay },
+                None if line.starts_with(b"Delay: ") => return error(line_no, "malformed \"Delay\" line"),
+                None => State::Start,
+            },
+            State::Locations { delay } => match parse_locations(line) {
+                Some(corrupted) => State::Diffs { delay, corrupted },
+                None => return error(line_no, "malformed list of locations"),
+            },
+            State::Diffs { delay, corrupted } => {
+                let bit_count = match parse_diffs(line) {
+                    Some(n) => n,
+                    None => return error(line_no, "malformed \"Diffs\" line"),
+                };
+                // If the list wasn't truncated, it holds every corrupt
+                // byte, and the diff count is the total of bits set in
+                // their xor masks.
+                if corrupted.len() != MAX_RECORDED && bit_count != corrupted
+                    .iter()
+                    .map(|&l| location_mask(l).count_ones() as usize)
+                    .sum::<usize>()
+                {
+                    return error(line_no, "diff count doesn't match the locations");
+                }
+                entries.push(Entry { delay, corrupted, bit_count, ecc: None, module: 0 });
+                State::Done
+            }
+            State::Done => {
+                if line.starts_with(b"Delay: ") || line.starts_with(b"Diffs: ") {
+                    return error(line_no, "unexpected line after \"Diffs\" line");
+                }
+                if line.starts_with(b"ECC: ") {
+                    let entry = entries.last_mut().unwrap();
+                    entry.ecc = match (entry.ecc, parse_ecc(line)) {
+                        (None, Some(ecc)) => Some(ecc),
+                        (Some(_), _) => return error(line_no, "repeated \"ECC\" line"),
+                        (_, None) => return error(line_no, "malformed \"ECC\" line"),
+                    };
+                }
+                if line.starts_with(b"Module: ") {
+                    match parse_module(line) {
+                        Some(m) => entries.last_mut().unwrap().module = m,
+                        None => return error(line_no, "malformed \"Module\" line"),
+                    }
+                }
+                State::Done
+            }
+        };
+    }
+
+    match state {
+        State::Done | State::Start => Ok(entries),
+        _ => error(line_no, "entry ends before its \"Diffs\" line"),
+    }
+}
+
+// Generate a table of fraction of time corrupted, vs. delay and
+// location. The idea is to see if it's always the same locations that
+// are most corruptable, and that there's some threshold time at which
+// their RC constant is too low, and they just corrupt.
+pub fn generate_corruptability<W: Write>(stats: &[Entry], out: &mut W) -> io::Result<()> {
+    // We're going to be inefficient because the data set is small,
+    // and it's easier that way...
+
+    // Start by collecting all known corrupted addresses:
+    let corrupted: HashSet<Location> = stats
+        .iter()
+        .map(|stat| stat.corrupted.iter().cloned())
+        .flatten()
+        .collect();
+
+    // And collect all delays at which corruption occurs:
+    let delays: HashSet<usize> = stats
+        .iter()
+        .filter(|e| !e.corrupted.is_empty())
+        .map(|e| e.delay)
+        .collect();
+
+    // Build entries for all pairs.
+    #[derive(Clone, Debug, Eq, Hash, PartialEq)]
+    struct Key {
+        delay: usize,
+        location: Location,
+    };
+    #[derive(Clone, Debug)]
+    struct Value {
+        numerator: usize,
+        denominator: usize
+    };
+
+    let mut data: HashMap<Key, Value> = HashMap::new();
+    for addr in corrupted.iter() {
+        for delay in delays.iter() {
+            data.insert(Key { delay: *delay, location: *addr },
+                        Value { numerator: 0, denominator: 0 });
+        }
+    }
+
+    // And populate the numerators and denominators.
+    for entry in stats.iter() {
+        // Numerators: Does the address occur in the corrupted list?
+        for addr in entry.corrupted.iter() {
+            data
+                .get_mut(&Key { delay: entry.delay, location: *addr })
+                .unwrap()
+                .numerator += 1;
+        }
+        // Denominator: All addresses are included, unless they fall
+        // off the upper end of the corrupted list, in which case the
+        // numerator isn't bumped, so we shouldn't bump the denominator.
+        let max_recorded = if entry.corrupted.len() == MAX_RECORDED {
+            entry.corrupted[MAX_RECORDED - 1]
+        } else {
+            Location::MAX
+        };
+        for (k, v) in data.iter_mut() {
+            if k.delay == entry.delay && k.location <= max_recorded {
+                v.denominator += 1;
+            }
+        }
+    }
+
+    // Now we want to order the addresses by when they first appear.
+    let addrs_in_order = {
+        let mut addr_map = HashMap::new();
+        for entry in stats.iter() {
+            for addr in entry.corrupted.iter() {
+                // Update the first usgae time if it's non-existent,
+                // or greater than the currently-recorded value. Sort
+                // secondarily on fraction of time corrupted.
+
+                if addr_map.get(addr).map_or(true, |&(usage, _)| usage > entry.delay) {
+                    let d = data.get(&Key { delay: entry.delay, location: *addr }).unwrap();
+                    // Integer to keep sortable.
+                    let fraction = 100 - d.numerator * 100 / d.denominator;
+                    addr_map.insert(*addr, (entry.delay, fraction));
+                }
+            }
+        }
+        let mut sorted_addrs = addr_map
+            .into_iter()
+            .map(|(k, v)| (v, k))
+            .collect::<Vec<((usize, usize), Location)>>();
+        sorted_addrs.sort();
+        sorted_addrs.into_iter().map(|(_, v)| v).collect::<Vec<Location>>()
+    };
+
+    // We've got the data, we've got the delays and addresses, let's
+    // print the table!
+
+    // Header row.
+    let mut delays_vec = delays.iter().map(|x| *x).collect::<Vec<usize>>();
+    delays_vec.sort();
+    let delays_strings = delays_vec.iter().map(|&x| x.to_string()).collect::<Vec<String>>();
+    writeln!(out, ", {}", delays_strings.join(", "))?;
+
+    // Row for each address.
+    for addr in addrs_in_order.iter() {
+        write!(out, "{:06X}", addr)?;
+        for delay in delays_vec.iter() {
+            let entry = data.get(&Key { delay: *delay, location: *addr }).unwrap();
+            write!(out, ", {}", entry.numerator as f64 / entry.denominator as f64)?;
+        }
+        writeln!(out)?;
+    }
+    Ok(())
+}
+
+// Generate a very simple table of average bit flip rates per decay
+// period. For logs from ECC mode, add a row of the fraction of ECC
+// words that were uncorrectable.
+pub fn generate_flip_rates<W: Write>(stats: &[Entry], out: &mut W) -> io::Result<()>
+{
+    // Store numerator and denominator, per delay, for bits and for
+    // ECC words.
+    let mut flip_rates: HashMap<usize, ((usize, usize), (usize, usize))> = HashMap::new();
+
+    // Collect data.
+    for entry in stats.iter() {
+        if !flip_rates.contains_key(&entry.delay) {
+            flip_rates.insert(entry.delay, ((0, 0), (0, 0)));
+        }
+        let ((num, denom), (ecc_num, ecc_denom)) = flip_rates.get_mut(&entry.delay).unwrap();
+        *num += entry.bit_count;
+        *denom += TESTED_BITS;
+        if let Some(ecc) = entry.ecc {
+            *ecc_num += ecc.uncorrectable;
+            *ecc_denom += ecc.words;
+        }
+    }
+    let has_ecc = stats.iter().any(|e| e.ecc.is_some());
+
+    // Sort it.
+    let mut flip_rates_vec = flip_rates
+        .iter()
+        .map(|(&delay, ((num, denom), (ecc_num, ecc_denom)))| {
+            (delay, *num as f64 / *denom as f64, *ecc_num as f64 / *ecc_denom as f64)
+        })
+        .collect::<Vec<(usize, f64, f64)>>();
+    flip_rates_vec.sort_by(|(a, _, _), (b, _, _)| a.cmp(b));
+
+    // Print it.
+    writeln!(out, "{}", flip_rates_vec.iter().map(|(delay, _, _)| delay.to_string()).collect::<Vec<String>>().join(","))?;
+    writeln!(out, "{}", flip_rates_vec.iter().map(|(_, frac, _)| frac.to_string()).collect::<Vec<String>>().join(","))?;
+    if has_ecc {
+        writeln!(out, "{}", flip_rates_vec.iter().map(|(_, _, frac)| frac.to_string()).collect::<Vec<String>>().join(","))?;
+    }
+    Ok(())
+}
+
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const SEP: &str = "--------------------------------\n";
+
+    fn parse_err(log: &str) -> (usize, String) {
+        let e = parse_log(log).unwrap_err();
+        (e.line, e.message)
+    }
+
+    #[test]
+    fn parses_entries() {
+        let log = format!(
+            "Calibrating...\nDelay: 1000, Pattern: 00\n\nDiffs: 0\n{}\
+             Delay: 2000, Pattern: 00\n010203,3F0080,\nDiffs: 3\nECC: words 448, corrected 2, uncorrectable 0\n\
+             Module: 1\nPower: 5V\n",
+            SEP);
+        let entries = parse_log(&log).unwrap();
+        assert_eq!(entries.len(), 2);
+        assert_eq!(entries[0].delay, 1000);
+        assert!(entries[0].corrupted.is_empty());
+        assert_eq!(entries[0].module, 0);
+        assert_eq!(entries[1].corrupted, vec![0x010203, 0x3f0080]);
+        assert_eq!(entries[1].bit_count, 3);
+        assert_eq!(entries[1].module, 1);
+        let ecc = entries[1].ecc.unwrap();
+        assert_eq!((ecc.words, ecc.corrected, ecc.uncorrectable), (448, 2, 0));
+    }
+
+    #[test]
+    fn accepts_raw_firmware_output() {
+        let log = format!("Delay: 1000, Pattern: 00\n\nDiffs: 0\n{}Sweep: 2\n", SEP);
+        assert_eq!(parse_log(&log).unwrap().len(), 1);
+        assert_eq!(parse_log("").unwrap().len(), 0);
+    }
+
+    #[test]
+    fn accepts_crlf_line_ends() {
+        let log = format!("Delay: 1000, Pattern: 00\n010203,\nDiffs: 2\nPower: 5V\n{}", SEP)
+            .replace('\n', "\r\n");
+        let entries = parse_log(&log).unwrap();
+        assert_eq!(entries.len(), 1);
+        assert_eq!(entries[0].corrupted, vec![0x010203]);
+        assert_eq!(entries[0].bit_count, 2);
+    }
+
+    #[test]
+    fn accepts_hex_patterns() {
+        for pattern in ["FF", "aa", "5A"].iter() {
+            let log = format!("Delay: 1000, Pattern: {}\n\nDiffs: 0\n", pattern);
+            assert_eq!(parse_log(&log).unwrap()[0].delay, 1000, "{}", pattern);
+        }
+        assert_eq!(parse_err("Delay: 1000, Pattern: 0G\n").1, "malformed \"Delay\" line");
+    }
+
+    #[test]
+    fn truncated_list_needs_no_matching_count() {
+        let list = "000001,".repeat(MAX_RECORDED);
+        let log = format!("Delay: 1000, Pattern: 00\n{}\nDiffs: 100\n", list);
+        assert_eq!(parse_log(&log).unwrap()[0].bit_count, 100);
+    }
+
+    #[test]
+    fn reports_errors_by_line() {
+        let entry = "Delay: 1000, Pattern: 00\n\nDiffs: 0\n";
+        let cases = [
+            (format!("Delay: x, Pattern: 00\n"), 1, "malformed \"Delay\" line"),
+            (format!("{}{}Delay: 1, Pattern: 00\n0102,\nDiffs: 1\n", entry, SEP), 6, "malformed list of locations"),
+            (format!("Delay: 1, Pattern: 00\n01020G,\nDiffs: 1\n"), 2, "malformed list of locations"),
+            (format!("Delay: 1, Pattern: 00\n\nDiffs: x\n"), 3, "malformed \"Diffs\" line"),
+            (format!("Delay: 1, Pattern: 00\n010203,\nDiffs: 1\n"), 3, "diff count doesn't match the locations"),
+            (format!("{}{}Delay: 1, Pattern: 00\n{}", entry, SEP, SEP), 6, "entry ends before its \"Diffs\" line"),
+            (format!("{}{}Delay: 1, Pattern: 00\n", entry, SEP), 6, "entry ends before its \"Diffs\" line"),
+            (format!("{}{}{}", entry, SEP, SEP), 5, "entry has no \"Delay\" line"),
+            (format!("{}Diffs: 0\n", entry), 4, "unexpected line after \"Diffs\" line"),
+            (format!("{}ECC: words 1\n", entry), 4, "malformed \"ECC\" line"),
+            (format!("{}ECC: words 1, corrected 0, uncorrectable 0\nECC: words 1, corrected 0, uncorrectable 0\n", entry),
+             5, "repeated \"ECC\" line"),
+            (format!("{}Module: x\n", entry), 4, "malformed \"Module\" line"),
+        ];
+        for (log, line, message) in cases.iter() {
+            assert_eq!(parse_err(log), (*line, message.to_string()), "{:?}", log);
+        }
+    }
+}
@@ -0,0 +1,95 @@
+//
+// Counter-based random numbers, so that any cell of any experiment
+// (or any bootstrap resample) can be generated independently, on any
+// thread, and reproducibly from a seed.
+//
+
+pub fn splitmix64(mut x: u64) -> u64 {
+    x = x.wrapping_add(0x9e3779b97f4a7c15);
+    x = (x ^ (x >> 30)).wrapping_mul(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)).wrapping_mul(0x94d049bb133111eb);
+    x ^ (x >> 31)
+}
+
+pub fn hash(seed: u64, a: u64, b: u64) -> u64 {
+    splitmix64(splitmix64(splitmix64(seed) ^ a) ^ b)
+}
+
+// Uniform in (0, 1].
+pub fn unit(h: u64) -> f64 {
+    ((h >> 11) + 1) as f64 * (1.0 / (1u64 << 53) as f64)
+}
+
+// Evaluate a polynomial with coefficients in increasing powers.
+fn poly(c: &[f64; 8], x: f64) -> f64 {
+    c.iter().rev().fold(0.0, |acc, &c| acc * x + c)
+}
+
+// Standard normal, by inverting the CDF at a uniform from the hash,
+// with Wichura's AS 241 (accurate to about 1e-16). Most values come
+// from the central rational approximation, with no logs or trig, so
+// this is several times faster than Box-Muller.
+pub fn normal(h: u64) -> f64 {
+    const A: [f64; 8] = [
+        3.3871328727963666080e0, 1.3314166789178437745e2, 1.9715909503065514427e3,
+        1.3731693765509461125e4, 4.5921953931549871457e4, 6.7265770927008700853e4,
+        3.3430575583588128105e4, 2.5090809287301226727e3,
+    ];
+    const B: [f64; 8] = [
+        1.0, 4.2313330701600911252e1, 6.8718700749205790830e2, 5.3941960214247511077e3,
+        2.1213794301586595867e4, 3.9307895800092710610e4, 2.8729085735721942674e4,
+        5.2264952788528545610e3,
+    ];
+    const C: [f64; 8] = [
+        1.42343711074968357734e0, 4.63033784615654529590e0, 5.76949722146069140550e0,
+        3.64784832476320460504e0, 1.27045825245236838258e0, 2.41780725177450611770e-1,
+        2.27238449892691845833e-2, 7.74545014278341407640e-4,
+    ];
+    const D: [f64; 8] = [
+        1.0, 2.05319162663775882187e0, 1.67638483018380384940e0, 6.89767334985100004550e-1,
+        1.48103976427480074590e-1, 1.51986665636164571966e-2, 5.47593808499534494600e-4,
+        1.05075007164441684324e-9,
+    ];
+    const E: [f64; 8] = [
+        6.65790464350110377720e0, 5.46378491116411436990e0, 1.78482653991729133580e0,
+        2.96560571828504891230e-1, 2.65321895265761230930e-2, 1.24266094738807843860e-3,
+        2.71155556874348757815e-5, 2.01033439929228813265e-7,
+    ];
+    const F: [f64; 8] = [
+        1.0, 5.99832206555887937690e-1, 1.36929880922735805310e-1, 1.48753612908506148525e-2,
+        7.86869131145613259100e-4, 1.84631831751005468180e-5, 1.42151175831644588870e-7,
+        2.04426310338993978564e-15,
+    ];
+
+    // Uniform in (0, 1), excluding both ends.
+    let p = ((h >> 12) as f64 + 0.5) * (1.0 / (1u64 << 52) as f64);
+    let q = p - 0.5;
+    if q.abs() <= 0.425 {
+        let r = 0.180625 - q * q;
+        return q * poly(&A, r) / poly(&B, r);
+    }
+    let r = (-(if q < 0.0 { p } else { 1.0 - p }).ln()).sqrt();
+    let z = if r <= 5.0 {
+        poly(&C, r - 1.6) / poly(&D, r - 1.6)
+    } else {
+        poly(&E, r - 5.0) / poly(&F, r - 5.0)
+    };
+    if q < 0.0 { -z } else { z }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::sim::normal_cdf;
+
+    // normal_cdf is good to about 1e-7, so the round trip should be too.
+    #[test]
+    fn normal_inverts_the_cdf() {
+        // Random points, and the very ends of the range.
+        for h in (0..100000u64).map(splitmix64).chain([0, 1 << 11, u64::MAX].iter().cloned()) {
+            let p = ((h >> 12) as f64 + 0.5) / (1u64 << 52) as f64;
+            let err = (normal_cdf(normal(h)) - p).abs() / p.min(1.0 - p);
+            assert!(err < 1e-6, "p {} z {} err {}", p, normal(h), err);
+        }
+    }
+}
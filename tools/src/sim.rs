@@ -0,0 +1,688 @@
+//
+// Monte Carlo simulation of DRAM decay, producing synthetic logs in
+// the same format as the Teensy firmware, so that the analyser can be
+// stress-tested with far more data than the rig can produce.
+//
+// The model is the one in the README: each cell has an RC constant
+// drawn from a log-normal distribution, and it decays if the
+// write-to-read delay exceeds it. We optionally mix in a second,
+// fatter log-normal component for the suspected weak tail, and add a
+// little per-experiment jitter so that cells near their threshold
+// sometimes decay and sometimes don't, like the real data.
+//
+// Cells are fixed properties of the simulated module: the same seed
+// gives the same weak cells on every sweep, just as the same
+// locations decay first on the real SIMM.
+//
+
+use std::io::{self, Write};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+
+use crate::rng::{hash, normal, splitmix64, unit};
+use crate::MAX_RECORDED;
+
+// Bytes per unit of parallel work.
+const CHUNK_BYTES: usize = 1 << 16;
+
+// Arrays up to this many cells have each delay's outcome
+// precomputed, bigger ones regenerate cells from the seed on each
+// pass.
+const CACHE_CELLS: usize = 1 << 24;
+
+// Beyond this many jitter standard deviations from the threshold, a
+// cell's fate is treated as certain.
+const JITTER_CUTOFF: f64 = 6.0;
+
+// fate()'s thresholds at steps of this many jitter standard
+// deviations, for bracketing the threshold without working it out.
+const THRESHOLD_STEP: f64 = 1.0 / 64.0;
+
+// Once the firmware's list of corrupt bytes is full, the remaining
+// uncertain cells only add to the count of decayed bits. If that
+// count's variance is at least this, it's drawn from a normal
+// approximation rather than a random number per cell.
+const APPROX_VARIANCE: f64 = 25.0;
+
+#[derive(Clone, Debug)]
+pub struct Config {
+    pub rows: usize,
+    pub cols: usize,
+    // Log-normal parameters of the RC constant, in ln(seconds).
+    pub mu: f64,
+    pub sigma: f64,
+    // Optional fat-tail mixture component.
+    pub tail_frac: f64,
+    pub tail_mu: f64,
+    pub tail_sigma: f64,
+    // Per-experiment jitter on each cell's ln(RC).
+    pub jitter: f64,
+    // Delays in a sweep, in seconds.
+    pub delays: Vec<u64>,
+    pub runs: usize,
+    pub seed: u64,
+    pub threads: usize,
+    pub summary: bool,
+    pub refresh: bool,
+    pub memory_bits: f64,
+    // Stop the log at an entry boundary once it reaches this size,
+    // rather than after a number of runs.
+    pub max_bytes: Option<u64>,
+    // Virtual SIMMs tested together, as with the firmware's N_MODULES.
+    pub modules: usize,
+}
+
+impl Config {
+    pub fn cells(&self) -> usize {
+        self.rows * self.cols * 8
+    }
+}
+
+impl Default for Config {
+    fn default() -> Config {
+        Config {
+            rows: 0x40,
+            cols: 0x40,
+            mu: (180.0f64).ln(),
+            sigma: 0.357,
+            tail_frac: 0.0,
+            tail_mu: (30.0f64).ln(),
+            tail_sigma: 1.0,
+            jitter: 0.05,
+            delays: default_delays(),
+            runs: 1,
+            seed: 1,
+            threads: thread::available_parallelism().map_or(1, |n| n.get()),
+            summary: false,
+            refresh: false,
+            memory_bits: (8 << 20) as f64,
+            max_bytes: None,
+            modules: 1,
+        }
+    }
+}
+
+// The firmware's sweep: 2^i seconds, interleaved with sqrt(2) * 2^i.
+pub fn default_delays() -> Vec<u64> {
+    let mut delays = Vec::new();
+    for i in 0..12 {
+        delays.push(1 << i);
+        delays.push(46340 >> (15 - i));
+    }
+    delays
+}
+
+// Streams, so that cell properties and experiment jitter don't
+// share random numbers.
+const STREAM_CELL: u64 = 0;
+const STREAM_TAIL: u64 = 1;
+const STREAM_JITTER: u64 = 2;
+const STREAM_MODULE: u64 = 3;
+const STREAM_COUNT: u64 = 4;
+
+fn cell_ln_rc(config: &Config, cell: usize) -> f32 {
+    let cell = cell as u64;
+    let z = normal(hash(config.seed, STREAM_CELL, cell));
+    let in_tail = config.tail_frac > 0.0
+        && unit(hash(config.seed, STREAM_TAIL, cell)) <= config.tail_frac;
+    if in_tail {
+        (config.tail_mu + config.tail_sigma * z) as f32
+    } else {
+        (config.mu + config.sigma * z) as f32
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Simulation.
+//
+
+// Result of one experiment (a single delay of a single sweep) over
+// part of the array.
+#[derive(Clone, Debug, Default)]
+struct Partial {
+    bit_count: u64,
+    // (byte address, xor mask), in address order.
+    corrupted: Vec<(u32, u8)>,
+}
+
+impl Partial {
+    fn record(&mut self, byte: u32, mask: u8) {
+        self.bit_count += mask.count_ones() as u64;
+        if self.corrupted.len() < MAX_RECORDED {
+            self.corrupted.push((byte, mask));
+        }
+    }
+}
+
+// How a cell fares at a given delay: certain to survive, certain to
+// decay, or decays if a uniform 64-bit random number is below the
+// threshold.
+enum Fate {
+    Survives,
+    Decays,
+    Maybe(u64),
+}
+
+// Per-experiment random numbers: one full hash per experiment, then
+// a single mixing step per cell, as this is the inner loop.
+fn experiment_key(config: &Config, experiment: u64) -> u64 {
+    hash(config.seed, STREAM_JITTER, experiment)
+}
+
+fn jitter_hash(key: u64, cell: usize) -> u64 {
+    splitmix64(key ^ cell as u64)
+}
+
+// The cell decays if ln_rc + jitter * z < ln_delay for standard
+// normal z, i.e. with probability Phi(-margin / jitter).
+fn fate(config: &Config, ln_rc: f64, ln_delay: f64) -> Fate {
+    let margin = ln_rc - ln_delay;
+    if config.jitter == 0.0 {
+        return if margin < 0.0 { Fate::Decays } else { Fate::Survives };
+    }
+    let z = margin / config.jitter;
+    if z > JITTER_CUTOFF {
+        Fate::Survives
+    } else if z < -JITTER_CUTOFF {
+        Fate::Decays
+    } else {
+        Fate::Maybe((normal_cdf(-z) * 18446744073709551616.0) as u64)
+    }
+}
+
+// Precomputed outcome of a single delay over the whole array. Only
+// the cells near their threshold need random numbers per experiment.
+struct DelayTable {
+    certain: Partial,
+    // (cell, threshold), in cell order.
+    uncertain: Vec<(u32, u64)>,
+    // Mean and variance of the number of uncertain[i..] that decay.
+    tail_moments: Vec<(f64, f64)>,
+}
+
+impl DelayTable {
+    fn new(certain: Partial, uncertain: Vec<(u32, u64)>) -> DelayTable {
+        let mut tail_moments = vec![(0.0, 0.0); uncertain.len() + 1];
+        for (i, &(_, t)) in uncertain.iter().enumerate().rev() {
+            let p = t as f64 / 18446744073709551616.0;
+            let (mean, var) = tail_moments[i + 1];
+            tail_moments[i] = (mean + p, var + p * (1.0 - p));
+        }
+        DelayTable { certain, uncertain, tail_moments }
+    }
+}
+
+struct Sim<'a> {
+    config: &'a Config,
+    ln_delays: Vec<f64>,
+    // The same, with their indices, in increasing order, so that the
+    // delays near a cell's threshold can be found by bisection.
+    sorted_ln_delays: Vec<(f64, usize)>,
+    // Largest ln(RC) that could still decay within the sweep.
+    ln_reach: f64,
+    // fate()'s threshold at z = -JITTER_CUTOFF + i * THRESHOLD_STEP.
+    thresholds: Vec<u64>,
+    // For arrays small enough to precompute, one per delay.
+    tables: Option<Vec<DelayTable>>,
+}
+
+impl<'a> Sim<'a> {
+    fn new(config: &'a Config) -> Sim<'a> {
+        let ln_delays = config.delays.iter().map(|&d| (d as f64).ln()).collect::<Vec<_>>();
+        let ln_reach = ln_delays.iter().cloned().fold(f64::MIN, f64::max)
+            + JITTER_CUTOFF * config.jitter;
+        let mut sorted_ln_delays = ln_delays.iter().cloned().zip(0..).collect::<Vec<_>>();
+        sorted_ln_delays.sort_by(|a, b| a.partial_cmp(b).unwrap());
+        let steps = (2.0 * JITTER_CUTOFF / THRESHOLD_STEP) as usize;
+        let thresholds = (0..=steps)
+            .map(|i| {
+                let z = -JITTER_CUTOFF + i as f64 * THRESHOLD_STEP;
+                (normal_cdf(-z) * 18446744073709551616.0) as u64
+            })
+            .collect();
+        let mut sim = Sim { config, ln_delays, sorted_ln_delays, ln_reach, thresholds, tables: None };
+        if config.cells() <= CACHE_CELLS {
+            sim.tables = Some(sim.build_tables());
+        }
+        sim
+    }
+
+    fn build_tables(&self) -> Vec<DelayTable> {
+        let config = self.config;
+        let cells = config.cells();
+        let threads = config.threads;
+
+        let mut ln_rcs = vec![0.0f32; cells];
+        let per_thread = (cells + threads - 1) / threads;
+        thread::scope(|s| {
+            for (i, part) in ln_rcs.chunks_mut(per_thread).enumerate() {
+                s.spawn(move || {
+                    for (j, v) in part.iter_mut().enumerate() {
+                        *v = cell_ln_rc(config, i * per_thread + j);
+                    }
+                });
+            }
+        });
+
+        let ln_rcs = &ln_rcs;
+        let build = |ln_delay: f64| {
+            let mut certain = Partial::default();
+            let mut uncertain = Vec::new();
+            for byte in 0..cells / 8 {
+                let mut mask = 0u8;
+                for bit in 0..8 {
+                    let cell = byte * 8 + bit;
+                    match fate(config, ln_rcs[cell] as f64, ln_delay) {
+                        Fate::Survives => (),
+                        Fate::Decays => mask |= 1 << bit,
+                        Fate::Maybe(t) => uncertain.push((cell as u32, t)),
+                    }
+                }
+                if mask != 0 {
+                    certain.record(byte as u32, mask);
+                }
+            }
+            DelayTable::new(certain, uncertain)
+        };
+        thread::scope(|s| {
+            let handles = self.ln_delays
+                .iter()
+                .map(|&ln_delay| s.spawn(move || build(ln_delay)))
+                .collect::<Vec<_>>();
+            handles.into_iter().map(|h| h.join().unwrap()).collect()
+        })
+    }
+
+    // Run one experiment from the precomputed tables.
+    fn run_table(&self, table: &DelayTable, experiment: u64) -> Partial {
+        let key = experiment_key(self.config, experiment);
+        let mut result = Partial { bit_count: table.certain.bit_count, corrupted: Vec::new() };
+        let certain = &table.certain.corrupted;
+        let mut next_certain = 0;
+        let mut pending: Option<(u32, u8)> = None;
+
+        // Merge in address order with the certain bytes. Uncertain
+        // decays only add bits, so are counted directly.
+        let mut emit = |result: &mut Partial, byte: u32, mask: u8| {
+            while next_certain < certain.len() && certain[next_certain].0 < byte {
+                if result.corrupted.len() < MAX_RECORDED {
+                    result.corrupted.push(certain[next_certain]);
+                }
+                next_certain += 1;
+            }
+            let mut mask = mask;
+            if next_certain < certain.len() && certain[next_certain].0 == byte {
+                mask |= certain[next_certain].1;
+                next_certain += 1;
+            }
+            if result.corrupted.len() < MAX_RECORDED {
+                result.corrupted.push((byte, mask));
+            }
+        };
+
+        // Only walk the uncertain cells until the list is full.
+        let uncertain = &table.uncertain;
+        let mut i = 0;
+        while i < uncertain.len() && result.corrupted.len() < MAX_RECORDED {
+            let (cell, threshold) = uncertain[i];
+            i += 1;
+            if jitter_hash(key, cell as usize) >= threshold {
+                continue;
+            }
+            result.bit_count += 1;
+            let byte = cell >> 3;
+            let bit = 1u8 << (cell & 7);
+            pending = match pending {
+                Some((b, m)) if b == byte => Some((b, m | bit)),
+                Some((b, m)) => {
+                    emit(&mut result, b, m);
+                    Some((byte, bit))
+                }
+                None => Some((byte, bit)),
+            };
+        }
+        if let Some((b, m)) = pending {
+            emit(&mut result, b, m);
+        }
+        // The rest just need counting.
+        let (mean, var) = table.tail_moments[i];
+        if var >= APPROX_VARIANCE {
+            let z = normal(hash(self.config.seed, STREAM_COUNT, experiment));
+            let n = (mean + var.sqrt() * z).round().max(0.0).min((uncertain.len() - i) as f64);
+            result.bit_count += n as u64;
+        } else {
+            result.bit_count += uncertain[i..]
+                .iter()
+                .filter(|&&(cell, threshold)| jitter_hash(key, cell as usize) < threshold)
+                .count() as u64;
+        }
+        // Anything left over from the certain list.
+        emit(&mut result, u32::MAX, 0);
+        result.corrupted.retain(|&(b, _)| b != u32::MAX);
+        result
+    }
+
+    // Whether a cell decays at a delay, given its jitter hash: the same
+    // as comparing the hash with fate()'s threshold, but the threshold
+    // is bracketed by the two nearest in the table, and the hash is
+    // nearly always outside the bracket, which saves an erfc.
+    fn decays(&self, ln_rc: f64, ln_delay: f64, h: u64) -> bool {
+        let z = (ln_rc - ln_delay) / self.config.jitter;
+        if !(z.abs() <= JITTER_CUTOFF) {
+            return z < 0.0;
+        }
+        let i = (((z + JITTER_CUTOFF) / THRESHOLD_STEP) as usize).min(self.thresholds.len() - 2);
+        if h < self.thresholds[i + 1] {
+            true
+        } else if h >= self.thresholds[i] {
+            false
+        } else {
+            match fate(self.config, ln_rc, ln_delay) {
+                Fate::Maybe(t) => h < t,
+                f => matches!(f, Fate::Decays),
+            }
+        }
+    }
+
+    // Simulate every delay of one sweep over a range of bytes, for
+    // arrays too big to precompute.
+    //
+    // A cell survives the delays well below its threshold, and decays
+    // at all those well above it, so with the delays sorted, only the
+    // few in between need working out. The certain decays are counted
+    // with a +1 at the first such delay, summed up at the end. Masks
+    // are only needed while a delay's list of corrupt bytes has room,
+    // which for the long delays is just the start of the array.
+    fn run_chunk(&self, run: usize, bytes: std::ops::Range<usize>) -> Vec<Partial> {
+        let config = self.config;
+        let sorted = &self.sorted_ln_delays;
+        let n = sorted.len();
+        let mut partials = vec![Partial::default(); n];
+        let mut masks = vec![0u8; n];
+        let keys = (0..n)
+            .map(|d| experiment_key(config, (run * n + d) as u64))
+            .collect::<Vec<_>>();
+        // Widened a touch, so rounding never puts a cell fate() finds
+        // uncertain outside the band.
+        let band = JITTER_CUTOFF * config.jitter * (1.0 + 1e-9);
+        // Certain decays starting at each sorted delay.
+        let mut decays_from = vec![0u64; n + 1];
+        // One past the last sorted delay whose list has room.
+        let mut open = n;
+
+        for byte in bytes {
+            let mut any = false;
+            for bit in 0..8 {
+                let cell = byte * 8 + bit;
+                let ln_rc = cell_ln_rc(config, cell) as f64;
+                if ln_rc > self.ln_reach {
+                    continue;
+                }
+                let lo = sorted.partition_point(|&(l, _)| l < ln_rc - band);
+                let hi = sorted.partition_point(|&(l, _)| l <= ln_rc + band);
+                decays_from[hi] += 1;
+                // Without jitter, these are exactly at the threshold,
+                // so survive.
+                let uncertain = if config.jitter > 0.0 { &sorted[lo..hi] } else { &[] };
+                for (k, &(ln_delay, d)) in (lo..).zip(uncertain) {
+                    if self.decays(ln_rc, ln_delay, jitter_hash(keys[d], cell)) {
+                        partials[d].bit_count += 1;
+                        if k < open {
+                            masks[d] |= 1 << bit;
+                            any = true;
+                        }
+                    }
+                }
+                for &(_, d) in sorted[hi..open.max(hi)].iter() {
+                    masks[d] |= 1 << bit;
+                    any = true;
+                }
+            }
+            if !any {
+                continue;
+            }
+            for &(_, d) in &sorted[..open] {
+                if masks[d] != 0 {
+                    if partials[d].corrupted.len() < MAX_RECORDED {
+                        partials[d].corrupted.push((byte as u32, masks[d]));
+                    }
+                    masks[d] = 0;
+                }
+            }
+            while open > 0 && partials[sorted[open - 1].1].corrupted.len() == MAX_RECORDED {
+                open -= 1;
+            }
+        }
+
+        let mut decaying = 0;
+        for (k, &(_, d)) in sorted.iter().enumerate() {
+            decaying += decays_from[k];
+            partials[d].bit_count += decaying;
+        }
+        partials
+    }
+
+    // Run a batch of sweeps in parallel, returning one result per
+    // experiment, in sweep-then-delay order.
+    fn run_batch(&self, runs: std::ops::Range<usize>) -> Vec<Partial> {
+        let n = self.ln_delays.len();
+        let bytes = self.config.rows * self.config.cols;
+        // Small arrays are split by sweep, big ones by address too.
+        let chunks = match self.tables {
+            Some(_) => 1,
+            None => (bytes + CHUNK_BYTES - 1) / CHUNK_BYTES,
+        };
+        let first_run = runs.start;
+        let items = runs.len() * chunks;
+        let next = AtomicUsize::new(0);
+        let results: Mutex<Vec<(usize, Vec<Partial>)>> = Mutex::new(Vec::with_capacity(items));
+
+        thread::scope(|s| {
+            for _ in 0..self.config.threads.min(items) {
+                s.spawn(|| loop {
+                    let item = next.fetch_add(1, Ordering::Relaxed);
+                    if item >= items {
+                        break;
+                    }
+                    let run = first_run + item / chunks;
+                    let partials = match &self.tables {
+                        Some(tables) => tables
+                            .iter()
+                            .enumerate()
+                            .map(|(d, table)| self.run_table(table, (run * n + d) as u64))
+                            .collect(),
+                        None => {
+                            let chunk = item % chunks;
+                            let range = chunk * CHUNK_BYTES..((chunk + 1) * CHUNK_BYTES).min(bytes);
+                            self.run_chunk(run, range)
+                        }
+                    };
+                    results.lock().unwrap().push((item, partials));
+                });
+            }
+        });
+
+        // Merge the chunks of each sweep in address order.
+        let mut results = results.into_inner().unwrap();
+        results.sort_by_key(|(item, _)| *item);
+        let mut merged = Vec::with_capacity(runs.len() * n);
+        for sweep in results.chunks(chunks) {
+            for d in 0..n {
+                let mut total = Partial::default();
+                for (_, partials) in sweep.iter() {
+                    let p = &partials[d];
+                    total.bit_count += p.bit_count;
+                    let room = MAX_RECORDED - total.corrupted.len();
+                    total.corrupted.extend(p.corrupted.iter().take(room));
+                }
+                merged.push(total);
+            }
+        }
+        merged
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Output.
+//
+
+const HEX: &[u8; 16] = b"0123456789ABCDEF";
+
+fn push_hex(out: &mut Vec<u8>, b: u8) {
+    out.push(HEX[(b >> 4) as usize]);
+    out.push(HEX[(b & 15) as usize]);
+}
+
+// Exactly what test_decays prints, less the trailing separator, which
+// is written between entries.
+fn write_entry(out: &mut Vec<u8>, config: &Config, delay_s: u64, p: &Partial, module: usize) {
+    out.extend_from_slice(format!("Delay: {}000, Pattern: 00\n", delay_s).as_bytes());
+    for &(byte, mask) in p.corrupted.iter() {
+        let byte = byte as usize;
+        push_hex(out, (byte / config.cols) as u8);
+        push_hex(out, (byte % config.cols) as u8);
+        push_hex(out, mask);
+        out.push(b',');
+    }
+    out.extend_from_slice(format!("\nDiffs: {}\n", p.bit_count).as_bytes());
+    if config.modules > 1 {
+        out.extend_from_slice(format!("Module: {}\n", module).as_bytes());
+    }
+}
+
+// Each virtual SIMM is a separately seeded module. The first keeps the
+// main seed, so a single module is the same as ever.
+fn module_config(config: &Config, module: usize) -> Config {
+    let seed = match module {
+        0 => config.seed,
+        m => hash(config.seed, STREAM_MODULE, m as u64),
+    };
+    Config { seed, ..config.clone() }
+}
+
+// With several modules, the entries come out in the same order as
+// from the firmware's scheduler: each delay is run on every module in
+// turn. Only the order is simulated; every module gets exactly the
+// nominal delay, without the offsets of the other modules' writes and
+// reads.
+pub fn simulate<W: Write>(config: &Config, out: &mut W) -> io::Result<()> {
+    let configs = (0..config.modules).map(|m| module_config(config, m)).collect::<Vec<_>>();
+    let sims = configs.iter().map(Sim::new).collect::<Vec<_>>();
+    let n = config.delays.len();
+    let bytes = config.rows * config.cols;
+    // Keep a bounded number of experiments in flight.
+    let chunks = (bytes + CHUNK_BYTES - 1) / CHUNK_BYTES;
+    let batch = (config.threads * 64 / (chunks * config.modules)).max(1);
+    let runs = match config.max_bytes {
+        Some(_) => usize::MAX,
+        None => config.runs,
+    };
+
+    let mut totals = vec![0u64; n];
+    let mut done_runs = 0;
+    let mut written = 0u64;
+    let mut buf = Vec::new();
+
+    let mut run = 0;
+    'outer: while run < runs {
+        let end = run.saturating_add(batch).min(runs);
+        let results = sims.iter().map(|sim| sim.run_batch(run..end)).collect::<Vec<_>>();
+        buf.clear();
+        for i in 0..results[0].len() {
+            let d = i % n;
+            for (m, module_results) in results.iter().enumerate() {
+                let p = &module_results[i];
+                totals[d] += p.bit_count;
+                if d == n - 1 && m == config.modules - 1 {
+                    done_runs += 1;
+                }
+                if !config.summary {
+                    if run + i / n != 0 || d != 0 || m != 0 {
+                        buf.extend_from_slice(b"--------------------------------\n");
+                    }
+                    write_entry(&mut buf, config, config.delays[d], p, m);
+                }
+                if config.max_bytes.map_or(false, |max| written + buf.len() as u64 >= max) {
+                    out.write_all(&buf)?;
+                    break 'outer;
+                }
+            }
+        }
+        out.write_all(&buf)?;
+        written += buf.len() as u64;
+        run = end;
+    }
+
+    if config.summary {
+        // Same layout as simm_analyse's flip rate table.
+        let denom = (done_runs.max(1) * config.cells() * config.modules) as f64;
+        let delays = config.delays.iter().map(|d| format!("{}000", d)).collect::<Vec<_>>();
+        let rates = totals.iter().map(|&t| (t as f64 / denom).to_string()).collect::<Vec<_>>();
+        writeln!(out, "{}", delays.join(","))?;
+        writeln!(out, "{}", rates.join(","))?;
+    }
+    Ok(())
+}
+
+////////////////////////////////////////////////////////////////////////
+// Refresh failure estimates.
+//
+
+// Complementary error function, with fractional error below 1.2e-7
+// everywhere, which matters as we care about the far tail.
+// (Numerical Recipes' erfcc.)
+pub fn erfc(x: f64) -> f64 {
+    let z = x.abs();
+    let t = 1.0 / (1.0 + 0.5 * z);
+    let r = t * (-z * z - 1.26551223
+        + t * (1.00002368
+        + t * (0.37409196
+        + t * (0.09678418
+        + t * (-0.18628806
+        + t * (0.27886807
+        + t * (-1.13520398
+        + t * (1.48851587
+        + t * (-0.82215223
+        + t * 0.17087277))))))))).exp();
+    if x >= 0.0 { r } else { 2.0 - r }
+}
+
+pub fn normal_cdf(z: f64) -> f64 {
+    0.5 * erfc(-z / std::f64::consts::SQRT_2)
+}
+
+// Probability a single cell has decayed after t seconds, including
+// the jitter (the sum of normals in log space is normal).
+pub fn cell_decay_probability(config: &Config, t: f64) -> f64 {
+    let component = |mu: f64, sigma: f64| {
+        let sigma = (sigma * sigma + config.jitter * config.jitter).sqrt();
+        normal_cdf((t.ln() - mu) / sigma)
+    };
+    (1.0 - config.tail_frac) * component(config.mu, config.sigma)
+        + config.tail_frac * component(config.tail_mu, config.tail_sigma)
+}
+
+pub fn refresh_table<W: Write>(config: &Config, out: &mut W) -> io::Result<()> {
+    writeln!(out, "interval_ms, p_cell, expected_failures, p_any_failure")?;
+    for i in 0..24 {
+        let ms = 1u64 << i;
+        let p = cell_decay_probability(config, ms as f64 / 1000.0);
+        // 1 - (1 - p)^N, without losing the small probabilities.
+        let p_any = -(config.memory_bits * (-p).ln_1p()).exp_m1();
+        writeln!(out, "{}, {:e}, {:e}, {:e}", ms, p, p * config.memory_bits, p_any)?;
+    }
+    Ok(())
+}
+
+// Parse a byte count with an optional binary K/M/G suffix, as used
+// for corpus sizes.
+pub fn parse_size(s: &str) -> Option<u64> {
+    let (digits, shift) = match s.chars().last()? {
+        'K' | 'k' => (&s[..s.len() - 1], 10),
+        'M' | 'm' => (&s[..s.len() - 1], 20),
+        'G' | 'g' => (&s[..s.len() - 1], 30),
+        _ => (s, 0),
+    };
+    digits.parse::<u64>().ok().map(|n| n << shift)
+}
@@ -0,0 +1,154 @@
+//
+// Per-cell retention time estimates, pooled over every run in a log.
+//
+// An experiment doesn't tell us a cell's retention time, only whether
+// it was below the delay (the cell decayed) or not (it survived), so
+// each observation is an interval: [0, delay) or [delay, inf). The
+// corruptability table just reports the fraction decayed at each
+// delay, which for a cell near its threshold can go up and down with
+// delay through sampling noise, and doesn't give a retention time.
+//
+// The nonparametric maximum likelihood (Turnbull) estimate of a
+// cell's retention time distribution from data like this ("current
+// status" data) is the isotonic regression of the decayed fractions
+// on delay, weighted by the number of trials: i.e. the nearest
+// non-decreasing CDF, found by pooling adjacent violators. From that
+// we read off the interval holding the cell's median retention time.
+//
+
+use std::io::{self, Write};
+use std::thread;
+
+use crate::tensor::{Tensor, COL};
+use crate::Entry;
+
+// A cell's estimated retention time distribution.
+#[derive(Clone, Debug)]
+pub struct Estimate {
+    pub cell: usize,
+    // P(retention time < delay) at each delay, or None for delays at
+    // which the cell was never observed.
+    pub cdf: Vec<Option<f64>>,
+    // The median retention time lies in (lo, hi], in the log's delay
+    // units. hi is infinite if fewer than half the trials decayed
+    // even at the longest delay.
+    pub median: (f64, f64),
+}
+
+// Weighted isotonic regression by pool adjacent violators. Each block
+// is (sum of decays, sum of trials, number of points pooled).
+fn pava(points: &[(u32, u32)]) -> Vec<f64> {
+    let mut blocks: Vec<(f64, f64, usize)> = Vec::with_capacity(points.len());
+    for &(k, n) in points.iter() {
+        blocks.push((k as f64, n as f64, 1));
+        while blocks.len() >= 2 {
+            let (k2, n2, c2) = blocks[blocks.len() - 1];
+            let (k1, n1, c1) = blocks[blocks.len() - 2];
+            if k1 / n1 <= k2 / n2 {
+                break;
+            }
+            blocks.pop();
+            *blocks.last_mut().unwrap() = (k1 + k2, n1 + n2, c1 + c2);
+        }
+    }
+    blocks
+        .into_iter()
+        .flat_map(|(k, n, c)| std::iter::repeat(k / n).take(c))
+        .collect()
+}
+
+pub fn estimate(cells: &Tensor, cell: usize) -> Estimate {
+    let observed = cells
+        .cell_counts(cell)
+        .enumerate()
+        .filter(|&(_, (_, n))| n > 0)
+        .collect::<Vec<_>>();
+    let fitted = pava(&observed.iter().map(|&(_, c)| c).collect::<Vec<_>>());
+
+    let mut cdf = vec![None; cells.delays.len()];
+    for (&(d, _), &f) in observed.iter().zip(fitted.iter()) {
+        cdf[d] = Some(f);
+    }
+
+    let mut median = (0.0, f64::INFINITY);
+    for (&(d, _), &f) in observed.iter().zip(fitted.iter()) {
+        if f >= 0.5 {
+            median.1 = cells.delays[d] as f64;
+            break;
+        }
+        median.0 = cells.delays[d] as f64;
+    }
+
+    Estimate { cell, cdf, median }
+}
+
+// Estimate every cell that decayed at least once, split across
+// threads. Cells that never decayed have an estimated CDF of zero
+// everywhere, and aren't worth reporting.
+pub fn estimate_all(cells: &Tensor, threads: usize) -> Vec<Estimate> {
+    let n = cells.cells();
+    let per_thread = (n + threads - 1) / threads.max(1);
+    if per_thread == 0 {
+        return Vec::new();
+    }
+    thread::scope(|s| {
+        let handles = (0..n)
+            .step_by(per_thread)
+            .map(|start| {
+                s.spawn(move || {
+                    (start..(start + per_thread).min(n))
+                        .filter(|&cell| cells.cell_counts(cell).any(|(k, _)| k > 0))
+                        .map(|cell| estimate(cells, cell))
+                        .collect::<Vec<_>>()
+                })
+            })
+            .collect::<Vec<_>>();
+        handles.into_iter().flat_map(|h| h.join().unwrap()).collect()
+    })
+}
+
+// Print a row per cell, ordered by median retention time, with the
+// cell as a single-bit "RRCCMM" location, the interval holding its
+// median, and its estimated CDF at each delay.
+pub fn generate_survival<W: Write>(stats: &[Entry], threads: usize, out: &mut W) -> io::Result<()> {
+    let cells = Tensor::new(stats);
+    let mut estimates = estimate_all(&cells, threads);
+    estimates.sort_by(|a, b| {
+        a.median.partial_cmp(&b.median).unwrap().then(a.cell.cmp(&b.cell))
+    });
+
+    let delays = cells.delays.iter().map(|d| d.to_string()).collect::<Vec<_>>();
+    writeln!(out, ", median from, median to, {}", delays.join(", "))?;
+    for e in estimates.iter() {
+        let byte = e.cell / 8;
+        write!(out, "{:02X}{:02X}{:02X}, {}, {}",
+               byte / cells.shape[COL], byte % cells.shape[COL], 1 << (e.cell % 8),
+               e.median.0, e.median.1)?;
+        for f in e.cdf.iter() {
+            match f {
+                Some(f) => write!(out, ", {}", f)?,
+                None => write!(out, ",")?,
+            }
+        }
+        writeln!(out)?;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn pava_pools_violators() {
+        // Already monotone, so unchanged.
+        assert_eq!(pava(&[(0, 4), (1, 4), (4, 4)]), vec![0.0, 0.25, 1.0]);
+        // 0.5 then 0.3 is pooled by weight, into 8/20.
+        assert_eq!(pava(&[(1, 10), (5, 10), (3, 10), (8, 10)]), vec![0.1, 0.4, 0.4, 0.8]);
+        // A pool that violates the one before it is pooled again.
+        let fitted = pava(&[(3, 4), (1, 4), (0, 4)]);
+        assert!(fitted.iter().all(|&f| (f - 1.0 / 3.0).abs() < 1e-12), "{:?}", fitted);
+        // Weights: 9/10 outweighs 0/1, but not 0/10.
+        assert_eq!(pava(&[(0, 1), (9, 10), (0, 10)]), vec![0.0, 0.45, 0.45]);
+    }
+}
@@ -0,0 +1,375 @@
+//
+// A dense store of decay counts and trials for every delay, row,
+// column and bit of the tested array, built in one pass over the
+// parsed log. Once built, any slice of it (e.g. one delay, or one bit
+// lane) is just an offset and strides, and totals along any axis are
+// plain array sums, with no location strings or hashing.
+//
+// Bits are grouped into chips by a configurable lane-to-chip map, so
+// that e.g. the two 4-bit chips on the test SIMM can be compared.
+//
+// The tensor's bits are those of the firmware's xor masks, i.e. of
+// the Teensy's port B. The SIMM's data lines are wired to them in
+// reverse, so the chip map and the per-lane rates use the SIMM's DQ
+// numbers instead (see dq()).
+//
+
+use std::io::{self, Write};
+use std::ops::Range;
+
+use crate::{location_col, location_mask, location_row, Entry, MAX_RECORDED, TESTED_COLS, TESTED_ROWS};
+
+pub const DELAY: usize = 0;
+pub const ROW: usize = 1;
+pub const COL: usize = 2;
+pub const BIT: usize = 3;
+
+pub struct Tensor {
+    // Sorted delays that appear in the log.
+    pub delays: Vec<usize>,
+    // Delays, rows, columns and bits.
+    pub shape: [usize; 4],
+    // Times each bit was seen decayed, indexed [delay][row][col][bit].
+    counts: Vec<u32>,
+    // Times each byte was observed, indexed [delay][row][col]. All the
+    // bits of a byte are recorded together, so a bit's trials are at
+    // its count's index / 8.
+    trials: Vec<u32>,
+}
+
+impl Tensor {
+    // Build from a log. The array covers the firmware's tested rows and
+    // columns, or more if the log has locations outside them (e.g.
+    // from the simulator).
+    pub fn new(stats: &[Entry]) -> Tensor {
+        let mut delays = stats.iter().map(|e| e.delay).collect::<Vec<_>>();
+        delays.sort();
+        delays.dedup();
+
+        let (mut rows, mut cols) = (TESTED_ROWS, TESTED_COLS);
+        for &l in stats.iter().flat_map(|e| e.corrupted.iter()) {
+            rows = rows.max(location_row(l) + 1);
+            cols = cols.max(location_col(l) + 1);
+        }
+        let bytes = rows * cols;
+        let nd = delays.len();
+
+        let mut counts = vec![0u32; nd * bytes * 8];
+        // Each entry covers bytes up to its last recorded location,
+        // or all of them if the list wasn't truncated. Count those as
+        // a +1/-1 pair per entry, and sum them up at the end.
+        let mut starts = vec![0i64; nd * (bytes + 1)];
+        for entry in stats.iter() {
+            let d = delays.binary_search(&entry.delay).unwrap();
+            let mut end = bytes;
+            for (i, &l) in entry.corrupted.iter().enumerate() {
+                let byte = location_row(l) * cols + location_col(l);
+                let mask = location_mask(l);
+                for bit in 0..8 {
+                    if mask & (1 << bit) != 0 {
+                        counts[(d * bytes + byte) * 8 + bit] += 1;
+                    }
+                }
+                if entry.corrupted.len() == MAX_RECORDED && i == MAX_RECORDED - 1 {
+                    end = byte + 1;
+                }
+            }
+            starts[d * (bytes + 1)] += 1;
+            starts[d * (bytes + 1) + end] -= 1;
+        }
+
+        let mut trials = vec![0u32; nd * bytes];
+        for d in 0..nd {
+            let mut n = 0;
+            for byte in 0..bytes {
+                n += starts[d * (bytes + 1) + byte];
+                trials[d * bytes + byte] = n as u32;
+            }
+        }
+
+        Tensor { delays, shape: [nd, rows, cols, 8], counts, trials }
+    }
+
+    pub fn view(&self) -> View<'_> {
+        let [_, rows, cols, bits] = self.shape;
+        View {
+            tensor: self,
+            offset: 0,
+            shape: self.shape,
+            strides: [rows * cols * bits, cols * bits, bits, 1],
+        }
+    }
+
+    // (decays, trials) of a cell (byte * 8 + bit) at each delay.
+    pub fn cell_counts(&self, cell: usize) -> impl Iterator<Item = (u32, u32)> + '_ {
+        let stride = self.shape[ROW] * self.shape[COL] * 8;
+        (0..self.shape[DELAY]).map(move |d| {
+            let i = d * stride + cell;
+            (self.counts[i], self.trials[i / 8])
+        })
+    }
+
+    pub fn cells(&self) -> usize {
+        self.shape[ROW] * self.shape[COL] * 8
+    }
+
+    // Raw dump: "SIMMTNS1", then little-endian u32s: the shape, the
+    // delays, the counts and the trials, in the layouts above.
+    pub fn write_binary<W: Write>(&self, out: &mut W) -> io::Result<()> {
+        out.write_all(b"SIMMTNS1")?;
+        let words = self.shape
+            .iter()
+            .map(|&n| n as u32)
+            .chain(self.delays.iter().map(|&d| d as u32))
+            .chain(self.counts.iter().cloned())
+            .chain(self.trials.iter().cloned());
+        for w in words {
+            out.write_all(&w.to_le_bytes())?;
+        }
+        Ok(())
+    }
+
+    // Compact CSV: a row for each bit that ever decayed at each delay.
+    // Bits are port B bits, as in the log's masks, not DQ numbers.
+    // Bits not listed decayed in none of their trials, which are the
+    // same as for the listed bits of the same byte.
+    pub fn write_csv<W: Write>(&self, out: &mut W) -> io::Result<()> {
+        writeln!(out, "delay,row,col,bit,decayed,trials")?;
+        let [nd, rows, cols, bits] = self.shape;
+        for d in 0..nd {
+            for r in 0..rows {
+                for c in 0..cols {
+                    let byte = (d * rows + r) * cols + c;
+                    for b in 0..bits {
+                        let n = self.counts[byte * bits + b];
+                        if n != 0 {
+                            writeln!(out, "{},{},{},{},{},{}",
+                                     self.delays[d], r, c, b, n, self.trials[byte])?;
+                        }
+                    }
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+// A strided window onto a tensor. Slicing only adjusts the offset and
+// shape, so it's O(1).
+#[derive(Clone, Copy)]
+pub struct View<'a> {
+    tensor: &'a Tensor,
+    offset: usize,
+    pub shape: [usize; 4],
+    strides: [usize; 4],
+}
+
+impl<'a> View<'a> {
+    // Restrict an axis to a range of indices.
+    pub fn range(&self, axis: usize, r: Range<usize>) -> View<'a> {
+        assert!(r.start <= r.end && r.end <= self.shape[axis]);
+        let mut v = *self;
+        v.offset += r.start * self.strides[axis];
+        v.shape[axis] = r.end - r.start;
+        v
+    }
+
+    // Fix an axis at one index.
+    pub fn slice(&self, axis: usize, i: usize) -> View<'a> {
+        self.range(axis, i..i + 1)
+    }
+
+    // (decays, trials) at an index within the view.
+    pub fn get(&self, idx: [usize; 4]) -> (u32, u32) {
+        let i = self.offset + (0..4).map(|a| idx[a] * self.strides[a]).sum::<usize>();
+        (self.tensor.counts[i], self.tensor.trials[i / 8])
+    }
+
+    // Total (decays, trials) over the view.
+    pub fn sum(&self) -> (u64, u64) {
+        let [nd, rows, cols, bits] = self.shape;
+        let [sd, sr, sc, _] = self.strides;
+        let (mut k, mut n) = (0u64, 0u64);
+        for d in 0..nd {
+            for r in 0..rows {
+                for c in 0..cols {
+                    // Bits are contiguous, and share their trials.
+                    let i = self.offset + d * sd + r * sr + c * sc;
+                    k += self.tensor.counts[i..i + bits].iter().map(|&x| x as u64).sum::<u64>();
+                    n += self.tensor.trials[i / 8] as u64 * bits as u64;
+                }
+            }
+        }
+        (k, n)
+    }
+
+    // Totals for each index along an axis, summing over the others.
+    pub fn sum_along(&self, axis: usize) -> Vec<(u64, u64)> {
+        (0..self.shape[axis]).map(|i| self.slice(axis, i).sum()).collect()
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Chips.
+//
+
+// The SIMM data line read on a bit of port B: DQ0 is on B7, through
+// to DQ7 on B0.
+pub fn dq(bit: usize) -> usize {
+    7 - bit
+}
+
+pub struct ChipMap {
+    pub names: Vec<String>,
+    // Chip for each data line, by DQ number, or None if the line isn't
+    // on any of the named chips.
+    pub lanes: [Option<usize>; 8],
+}
+
+// The test SIMM: two 4-bit 422400s on the data lines. Its 1-bit
+// 421000 holds parity, which isn't wired up.
+impl Default for ChipMap {
+    fn default() -> ChipMap {
+        ChipMap::parse("422400a=0-3,422400b=4-7").unwrap()
+    }
+}
+
+impl ChipMap {
+    // Parse e.g. "U1=0-3,U2=4-7" or "U1=0,1,2,3": chip names, each
+    // with the data lines (DQ0-7) it drives.
+    pub fn parse(s: &str) -> Option<ChipMap> {
+        let mut map = ChipMap { names: Vec::new(), lanes: [None; 8] };
+        let mut chip = None;
+        for part in s.split(',') {
+            let lanes = match part.find('=') {
+                Some(i) => {
+                    map.names.push(part[..i].to_string());
+                    chip = Some(map.names.len() - 1);
+                    &part[i + 1..]
+                }
+                None => part,
+            };
+            let (lo, hi) = match lanes.find('-') {
+                Some(i) => (lanes[..i].parse::<usize>().ok()?, lanes[i + 1..].parse::<usize>().ok()?),
+                None => (lanes.parse::<usize>().ok()?, lanes.parse::<usize>().ok()?),
+            };
+            if lo > hi || hi >= 8 {
+                return None;
+            }
+            for lane in lo..=hi {
+                if map.lanes[lane].is_some() {
+                    return None;
+                }
+                map.lanes[lane] = Some(chip?);
+            }
+        }
+        Some(map)
+    }
+}
+
+// Flip rates per delay for each chip, and each data line, in the
+// layout of generate_flip_rates with a label column. Only the bytes
+// the firmware recorded count, so once more than 31 bytes decay, the
+// rates come from the start of the array rather than all of it.
+pub fn generate_chip_rates<W: Write>(stats: &[Entry], map: &ChipMap, out: &mut W) -> io::Result<()> {
+    let tensor = Tensor::new(stats);
+    let view = tensor.view();
+    let rate = |(k, n): (u64, u64)| (k as f64 / n as f64).to_string();
+
+    // Each data line's totals per delay; a chip's are the sum of its
+    // lines'.
+    let lanes = (0..8)
+        .map(|line| view.slice(BIT, dq(line)).sum_along(DELAY))
+        .collect::<Vec<_>>();
+
+    let delays = tensor.delays.iter().map(|d| d.to_string()).collect::<Vec<_>>();
+    writeln!(out, ",{}", delays.join(","))?;
+    for (chip, name) in map.names.iter().enumerate() {
+        let totals = (0..tensor.delays.len())
+            .map(|d| {
+                (0..8)
+                    .filter(|&line| map.lanes[line] == Some(chip))
+                    .map(|line| lanes[line][d])
+                    .fold((0, 0), |(k, n), (k2, n2)| (k + k2, n + n2))
+            })
+            .map(rate)
+            .collect::<Vec<_>>();
+        writeln!(out, "{},{}", name, totals.join(","))?;
+    }
+    for (line, lane) in lanes.iter().enumerate() {
+        writeln!(out, "DQ{},{}", line, lane.iter().map(|&t| rate(t)).collect::<Vec<_>>().join(","))?;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::Location;
+
+    fn entry(delay: usize, corrupted: Vec<Location>) -> Entry {
+        let bit_count = corrupted.iter().map(|&l| location_mask(l).count_ones() as usize).sum();
+        Entry { delay, corrupted, bit_count, ecc: None, module: 0 }
+    }
+
+    // Two entries at delay 1, one with a full list, and one at delay 2.
+    fn tensor() -> Tensor {
+        let full = (0..MAX_RECORDED as Location).map(|c| c << 8 | 0x01).collect();
+        Tensor::new(&[
+            entry(1, vec![0x000081, 0x010203]),
+            entry(1, full),
+            entry(2, vec![0x3f3f80]),
+        ])
+    }
+
+    #[test]
+    fn trials_end_at_a_full_list() {
+        let t = tensor();
+        assert_eq!(t.shape, [2, TESTED_ROWS, TESTED_COLS, 8]);
+        let v = t.view();
+        // The full list covers row 0 up to its last column.
+        assert_eq!(v.get([0, 0, 0, 0]), (2, 2));
+        assert_eq!(v.get([0, 0, 0, 7]), (1, 2));
+        assert_eq!(v.get([0, 0, MAX_RECORDED - 1, 0]), (1, 2));
+        assert_eq!(v.get([0, 0, MAX_RECORDED, 0]), (0, 1));
+        assert_eq!(v.get([0, 1, 2, 1]), (1, 1));
+        assert_eq!(v.get([1, 0x3f, 0x3f, 7]), (1, 1));
+    }
+
+    #[test]
+    fn views_sum_their_window() {
+        let t = tensor();
+        let v = t.view();
+        let bits = (TESTED_ROWS * TESTED_COLS * 8) as u64;
+        let recorded = (MAX_RECORDED * 8) as u64;
+        // Decays: 2 + 2 + 31 at delay 1, and 1 at delay 2.
+        assert_eq!(v.sum(), (36, 2 * bits + recorded));
+        assert_eq!(v.sum_along(DELAY), vec![(35, bits + recorded), (1, bits)]);
+
+        let row0 = v.slice(DELAY, 0).slice(ROW, 0);
+        assert_eq!(row0.shape, [1, 1, TESTED_COLS, 8]);
+        assert_eq!(row0.range(COL, 1..MAX_RECORDED).sum(), (30, 2 * 8 * (MAX_RECORDED - 1) as u64));
+        assert_eq!(row0.range(COL, 0..0).sum(), (0, 0));
+
+        let per_bit = v.slice(DELAY, 0).sum_along(BIT);
+        assert_eq!(per_bit.len(), 8);
+        assert_eq!(per_bit[0].0, 33);
+        assert_eq!((per_bit[1].0, per_bit[7].0), (1, 1));
+        assert!(per_bit.iter().all(|&(_, n)| n == per_bit[0].1));
+    }
+
+    #[test]
+    fn parses_chip_maps() {
+        let map = ChipMap::parse("U1=0,1,2,3,U2=4-7").unwrap();
+        assert_eq!(map.names, vec!["U1", "U2"]);
+        assert_eq!(map.lanes, [Some(0), Some(0), Some(0), Some(0), Some(1), Some(1), Some(1), Some(1)]);
+
+        // Lines left off the map aren't on any chip.
+        let map = ChipMap::parse("U1=2-3").unwrap();
+        assert_eq!(map.lanes, [None, None, Some(0), Some(0), None, None, None, None]);
+
+        for bad in ["U1=0-3,U2=3-7", "U1=0,0", "0-3", "U1=0-8", "U1=3-0", "U1=x", ""].iter() {
+            assert!(ChipMap::parse(bad).is_none(), "{}", bad);
+        }
+    }
+}
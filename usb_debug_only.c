@@ -26,6 +26,7 @@
 
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "usb_debug_only.h"
+#include "profile.h"
 
 /**************************************************************************
  *
@@ -250,7 +251,7 @@ uint8_t usb_configured(void)
 }
 
 // transmit a character.  0 returned on success, -1 on error
-int8_t usb_debug_putchar(uint8_t c)
+static inline int8_t debug_putchar(uint8_t c)
 {
 	static uint8_t previous_timeout=0;
 	uint8_t timeout, intr_state;
@@ -303,6 +304,18 @@ int8_t usb_debug_putchar(uint8_t c)
 }
 
 
+// transmit a character, profiled, as this is where we wait for USB.
+int8_t usb_debug_putchar(uint8_t c)
+{
+	int8_t r;
+
+	PROF_ENTER(PROF_PUTCHAR);
+	r = debug_putchar(c);
+	PROF_EXIT(PROF_PUTCHAR);
+	return r;
+}
+
+
 // immediately transmit any buffered output.
 void usb_debug_flush_output(void)
 {